@@ -18,9 +18,34 @@
 #include <unistd.h>
 #include <cstdlib>
 #include <ctime>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <cmath>
+#include <random>
+#include <cstring>
+#include <cctype>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <iomanip>
 
 using namespace std;
 
+// Building with -DDICE_STATS prints what the search did on stderr after every turn.
+// Without it the counters are compiled out and the search pays nothing.
+#ifdef DICE_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
+
 enum Direction
 {
     UP,
@@ -45,199 +70,474 @@ int getOppositeDirection(int direction)
     return -1;
 }
 
+int step(int position, int direction)
+{
+    switch (direction)
+    {
+    case UP:
+        return position - 8;
+    case DOWN:
+        return position + 8;
+    case LEFT:
+        return position - 1;
+    case RIGHT:
+        return position + 1;
+    }
+    return position;
+}
+
 /**
  * This game is weirdly done, a dice is:
  *        [ 1 ]              [Front ]
  *   [ 5 ][ 3 ][ 4 ]  [Left ][Up    ][Right]
  *        [ 6 ]              [Back  ]
  *        [ 2 ]              [Bottom]
+ * A die can only be in 24 orientations. They are all enumerated at compile time by rolling the die above,
+ * so a die is just an index in these tables.
  */
+struct OrientationTable
+{
+    // Faces in the order up, front, bottom, back, left, right.
+    uint8_t faces[24][6];
+    // roll[orientation][direction] is the orientation after rolling once in direction.
+    uint8_t roll[24][4];
+};
+
+// Faces cycled by a roll in each direction, indexed by Direction.
+constexpr int ROLL_CYCLES[4][4] = {{0, 1, 2, 3}, {0, 4, 2, 5}, {0, 3, 2, 1}, {0, 5, 2, 4}};
+
+constexpr OrientationTable buildOrientations()
+{
+    OrientationTable table = {};
+    const uint8_t start[6] = {3, 1, 2, 6, 5, 4};
+    for (int i = 0; i < 6; i++)
+    {
+        table.faces[0][i] = start[i];
+    }
+    int count = 1;
+    for (int orientation = 0; orientation < count; orientation++)
+    {
+        for (int direction = 0; direction < 4; direction++)
+        {
+            const int *cycle = ROLL_CYCLES[direction];
+            uint8_t next[6] = {};
+            for (int i = 0; i < 6; i++)
+            {
+                next[i] = table.faces[orientation][i];
+            }
+            next[cycle[0]] = table.faces[orientation][cycle[1]];
+            next[cycle[1]] = table.faces[orientation][cycle[2]];
+            next[cycle[2]] = table.faces[orientation][cycle[3]];
+            next[cycle[3]] = table.faces[orientation][cycle[0]];
+
+            int found = 0;
+            while (found < count && (table.faces[found][0] != next[0] || table.faces[found][1] != next[1] || table.faces[found][5] != next[5]))
+            {
+                found++;
+            }
+            if (found == count)
+            {
+                for (int i = 0; i < 6; i++)
+                {
+                    table.faces[count][i] = next[i];
+                }
+                count++;
+            }
+            table.roll[orientation][direction] = found;
+        }
+    }
+    return table;
+}
+
+constexpr OrientationTable ORIENTATIONS = buildOrientations();
+
 class Die
 {
 private:
-    // up, right,
-    int faces[6] = {0};
-    int position;
-    int owner;
-    int uniqueID;
-    int opposite[7] = {0, 6, 3, 2, 5, 4, 1};
+    uint8_t orientation = 0;
+    static int findOrientation(int up, int front, int right);
 
 public:
-    void
-    rotate(int direction);
-    int getFaceup() { return faces[0]; };
-    int getFacefront() { return faces[1]; };
-    int getFaceright() { return faces[5]; };
-    int getOwner() { return owner; };
-    int getPosition() { return position; };
-    int getUniqueID() { return uniqueID; };
-    Die(int position, int owner, int up, int front, int bottom, int back, int left, int right);
-    Die(int position, int owner, int up, int front, int right);
+    void rotate(int direction) { orientation = ORIENTATIONS.roll[orientation][direction]; };
+    int getFaceup() const { return ORIENTATIONS.faces[orientation][0]; };
+    int getFacefront() const { return ORIENTATIONS.faces[orientation][1]; };
+    int getFaceright() const { return ORIENTATIONS.faces[orientation][5]; };
+    int getOrientation() const { return orientation; };
+    Die() {};
+    explicit Die(int orientation) { this->orientation = orientation; };
+    Die(int up, int front, int right);
 };
 
-Die::Die(int position, int owner, int up, int front, int bottom, int back, int left, int right)
-{
-    this->position = position;
-    this->owner = owner;
-    this->faces[0] = up;
-    this->faces[1] = front;
-    this->faces[2] = bottom;
-    this->faces[3] = back;
-    this->faces[4] = left;
-    this->faces[5] = right;
-    this->uniqueID = position;
-}
+static_assert(sizeof(Die) == 1, "A die must stay a single byte so positions are cheap to copy");
 
-Die::Die(int position, int owner, int up, int front, int right)
+Die::Die(int up, int front, int right)
 {
-    this->position = position;
-    this->owner = owner;
-    this->faces[0] = up;
-    this->faces[1] = front;
-    this->faces[2] = opposite[up];
-    this->faces[3] = opposite[front];
-    this->faces[4] = opposite[right];
-    this->faces[5] = right;
-    this->uniqueID = position;
+    this->orientation = findOrientation(up, front, right);
 }
 
-void rotation(int face[], int pos1, int pos2, int pos3, int pos4)
+int Die::findOrientation(int up, int front, int right)
 {
-    int temp = face[pos1];
-    face[pos1] = face[pos2];
-    face[pos2] = face[pos3];
-    face[pos3] = face[pos4];
-    face[pos4] = temp;
+    // Up and front are enough to tell orientations apart, right is checked first in case the input
+    // describes a die which cannot be rolled into from ours.
+    int fallback = -1;
+    for (int o = 0; o < 24; o++)
+    {
+        const uint8_t *faces = ORIENTATIONS.faces[o];
+        if (faces[0] == up && faces[1] == front)
+        {
+            if (faces[5] == right)
+            {
+                return o;
+            }
+            fallback = o;
+        }
+        else if (faces[0] == up && fallback == -1)
+        {
+            fallback = o;
+        }
+    }
+    return fallback == -1 ? 0 : fallback;
 }
 
-void Die::rotate(int direction)
+/**
+ * Squares are numbered 0 (A8) to 63 (H1), one bit per square in the occupancy masks.
+ */
+inline uint64_t squareMask(int position) { return 1ULL << position; }
+const uint64_t FILE_A = 0x0101010101010101ULL;
+const uint64_t FILE_H = FILE_A << 7;
+
+// Evaluation weights, a die is worth DIE_VALUE. Threats are the opponent's dice we could land on,
+// hanging dice are ours the opponent could land on, we move first so they weigh less.
+const int DIE_VALUE = 100;
+const int MOBILITY_WEIGHT = 1;
+const int CONTROL_WEIGHT = 2;
+const int THREAT_WEIGHT = 40;
+const int HANGING_WEIGHT = 20;
+
+char toChar(int direction)
 {
     switch (direction)
     {
     case UP:
-        position -= 8;
-        rotation(faces, 0, 1, 2, 3);
-        break;
+        return 'U';
+    case RIGHT:
+        return 'R';
     case DOWN:
-        position += 8;
-        rotation(faces, 0, 3, 2, 1);
-        break;
+        return 'D';
     case LEFT:
-        position -= 1;
-        rotation(faces, 0, 5, 2, 4);
-        break;
-    case RIGHT:
-        position += 1;
-        rotation(faces, 0, 4, 2, 5);
-        break;
-    default:
-        break;
+        return 'L';
     }
+    return '?';
 }
 
-class Player
+int toDirection(char c)
 {
-private:
-    map<int, Die *> dice;
+    switch (c)
+    {
+    case 'U':
+        return UP;
+    case 'R':
+        return RIGHT;
+    case 'D':
+        return DOWN;
+    case 'L':
+        return LEFT;
+    }
+    return -1;
+}
 
-public:
-    void addDie(Die *d) { dice.insert(make_pair(d->getUniqueID(), d)); };
-    void removeDie(int uniqueID) { dice.erase(uniqueID); };
-    void showDice();
-    int nbDice() { return dice.size(); };
-    map<int, Die *> getDice() { return dice; };
+// NEIGHBOURS[position][direction] is the square reached by rolling once, or -1 when it leaves the board.
+struct NeighbourTable
+{
+    int8_t square[64][4];
+};
+
+constexpr NeighbourTable buildNeighbours()
+{
+    NeighbourTable table = {};
+    for (int position = 0; position < 64; position++)
+    {
+        table.square[position][UP] = position < 8 ? -1 : position - 8;
+        table.square[position][DOWN] = position > 55 ? -1 : position + 8;
+        table.square[position][RIGHT] = position % 8 == 7 ? -1 : position + 1;
+        table.square[position][LEFT] = position % 8 == 0 ? -1 : position - 1;
+    }
+    return table;
+}
+
+constexpr NeighbourTable NEIGHBOURS = buildNeighbours();
+
+// Directions are tried in this order so moves come out sorted like their string form.
+constexpr int SEARCH_ORDER[4] = {DOWN, LEFT, RIGHT, UP};
+
+/**
+ * A move is the starting square of the die and its path, two bits per step.
+ * A die rolls at most 6 cells so the whole path fits in 12 bits.
+ */
+struct Move
+{
+    uint16_t path = 0;
+    uint8_t from = 0;
+    uint8_t length = 0;
+    int getDirection(int i) const { return (path >> (2 * i)) & 3; };
+    int getDestination() const;
+    uint32_t pack() const { return path | from << 16 | length << 24; };
+    static Move unpack(uint32_t bits);
+    bool operator==(const Move &other) const { return path == other.path && from == other.from && length == other.length; };
+    bool operator<(const Move &other) const { return from != other.from ? from < other.from : (length != other.length ? length < other.length : path < other.path); };
 };
 
-void Player::showDice()
+Move Move::unpack(uint32_t bits)
+{
+    Move move;
+    move.path = bits & 0xFFFF;
+    move.from = (bits >> 16) & 0xFF;
+    move.length = (bits >> 24) & 0xFF;
+    return move;
+}
+
+int Move::getDestination() const
 {
-    for (const auto &it : dice)
+    int position = from;
+    for (int i = 0; i < length; i++)
     {
-        Die *d = it.second;
-        cout << d->getOwner() << ": " << d->getFaceup() << " at " << d->getPosition() << endl;
+        position = step(position, getDirection(i));
     }
+    return position;
 }
 
-class MoveTree
+// A die can follow at most 780 paths of 6 cells, and a player has at most 8 dice.
+const int MAX_DIE_MOVES = 780;
+const int MAX_MOVES = 8 * MAX_DIE_MOVES;
+
+/**
+ * A self-avoiding walk on the empty board: the squares strictly between its start and its end, its path
+ * and its last square.
+ */
+struct Walk
+{
+    uint64_t through;
+    uint16_t path;
+    uint8_t to;
+};
+
+/**
+ * Every walk of 1 to 6 steps from every square, about 78000 of them, built once at startup in the order
+ * the depth-first generator used to find them. A walk is a legal move when nothing stands on the squares it
+ * goes through and its last square does not hold one of the mover's dice, two mask tests instead of a walk.
+ */
+class WalkTable
 {
 private:
-    string current;
-    set<int> visited;
-    map<string, MoveTree *> sons;
-    int position;
+    vector<Walk> walks;
+    int first[64][7];
+    int count[64][7];
+    // Squares where the walks of a square and length end.
+    uint64_t endpoints[64][7];
+    void collect(int square, int length, int depth, int position, uint64_t visited, uint64_t through, uint16_t path);
 
 public:
-    void setVisited(set<int> v) { visited = v; };
-    map<string, MoveTree *> getSons() { return sons; };
-    string getCurrent() { return current; };
-    int getPosition() { return position; };
-    set<int> getVisited() { return visited; };
-    MoveTree(string move, int pos)
-    {
-        current = move;
-        position = pos;
-    };
-    void visit(int pos) { visited.insert(pos); };
-    void addSon(int direction);
+    WalkTable();
+    const Walk *getWalks(int square, int length) const { return walks.data() + first[square][length]; };
+    int getCount(int square, int length) const { return count[square][length]; };
+    uint64_t getEndpoints(int square, int length) const { return endpoints[square][length]; };
 };
 
-void MoveTree::addSon(int direction)
+WalkTable::WalkTable()
 {
-    string cur = current;
-    int pos = position;
-    switch (direction)
+    for (int square = 0; square < 64; square++)
     {
-    case UP:
-        if (visited.find(pos - 8) == visited.end())
+        for (int length = 0; length <= 6; length++)
         {
-            cur += "U";
-            MoveTree *t = new MoveTree(cur, pos - 8);
-            t->setVisited(visited);
-            t->visit(pos - 8);
-            sons[cur] = t;
+            first[square][length] = walks.size();
+            endpoints[square][length] = 0;
+            if (length > 0)
+            {
+                collect(square, length, 0, square, squareMask(square), 0, 0);
+            }
+            count[square][length] = walks.size() - first[square][length];
         }
-        break;
-    case DOWN:
-        if (visited.find(pos + 8) == visited.end())
+    }
+}
+
+void WalkTable::collect(int square, int length, int depth, int position, uint64_t visited, uint64_t through, uint16_t path)
+{
+    for (int direction : SEARCH_ORDER)
+    {
+        int next = NEIGHBOURS.square[position][direction];
+        if (next == -1 || (visited & squareMask(next)))
         {
-            cur += "D";
-            MoveTree *t = new MoveTree(cur, pos + 8);
-            t->setVisited(visited);
-            t->visit(pos + 8);
-            sons[cur] = t;
+            continue;
         }
-        break;
-    case RIGHT:
-        if (visited.find(pos + 1) == visited.end())
+        uint16_t extended = path | direction << (2 * depth);
+        if (depth + 1 == length)
         {
-            cur += "R";
-            MoveTree *t = new MoveTree(cur, pos + 1);
-            t->setVisited(visited);
-            t->visit(pos + 1);
-            sons[cur] = t;
+            walks.push_back({through, extended, (uint8_t)next});
+            endpoints[square][length] |= squareMask(next);
         }
-        break;
-    case LEFT:
-        if (visited.find(pos - 1) == visited.end())
+        else
         {
-            cur += "L";
-            MoveTree *t = new MoveTree(cur, pos - 1);
-            t->setVisited(visited);
-            t->visit(pos - 1);
-            sons[cur] = t;
+            collect(square, length, depth + 1, next, visited | squareMask(next), through | squareMask(next), extended);
         }
-        break;
-    default:
-        break;
     }
 }
 
+const WalkTable WALKS;
+
+/**
+ * What makeMove needs to put back to take a move back.
+ */
+struct Undo
+{
+    uint8_t from;
+    uint8_t to;
+    Die previous;
+    Die captured;
+    bool capture;
+    uint64_t hash;
+};
+
+// Only the last MAX_HISTORY moves can be taken back, older entries get overwritten.
+const int MAX_HISTORY = 64;
+
+/**
+ * Zobrist keys: a position hashes to the xor of the keys of its dice, so a move only updates a few of them.
+ * The keys come from a splitmix64 sequence at compile time, the side to move is mixed in by the search.
+ */
+struct ZobristTable
+{
+    uint64_t dice[2][64][24];
+    uint64_t side[2];
+};
+
+constexpr uint64_t splitMix(uint64_t &state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+constexpr ZobristTable buildZobrist()
+{
+    ZobristTable table = {};
+    uint64_t state = 0x44696365447565ULL;
+    for (int owner = 0; owner < 2; owner++)
+    {
+        for (int position = 0; position < 64; position++)
+        {
+            for (int orientation = 0; orientation < 24; orientation++)
+            {
+                table.dice[owner][position][orientation] = splitMix(state);
+            }
+        }
+    }
+    table.side[0] = 0;
+    table.side[1] = splitMix(state);
+    return table;
+}
+
+constexpr ZobristTable ZOBRIST = buildZobrist();
+
+string toString(int position)
+{
+    string pos = "__";
+    pos[1] = 56 - position / 8;
+    pos[0] = position % 8 + 65;
+    return pos;
+}
+
+// The move seen from the other side of the table, see Board::turned.
+Move turn(Move move)
+{
+    Move res;
+    res.from = 63 - move.from;
+    res.length = move.length;
+    for (int i = 0; i < move.length; i++)
+    {
+        res.path |= getOppositeDirection(move.getDirection(i)) << (2 * i);
+    }
+    return res;
+}
+
+string toString(Move move)
+{
+    string res = toString(move.from) + " ";
+    for (int i = 0; i < move.length; i++)
+    {
+        res += toChar(move.getDirection(i));
+    }
+    return res;
+}
+
+/**
+ * Bump allocator for everything built during a turn. Nothing is freed on its own,
+ * reset() drops it all at once, so the memory used stays bounded however long the game lasts.
+ */
+class Arena
+{
+private:
+    unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t used = 0;
+    size_t peak = 0;
+
+public:
+    Arena(size_t capacity);
+    void *allocate(size_t size, size_t alignment);
+    template <typename T, typename... Args>
+    T *create(Args... args);
+    template <typename T>
+    T *allocateArray(size_t count) { return (T *)allocate(count * sizeof(T), alignof(T)); };
+    void reset() { used = 0; };
+    size_t getUsed() { return used; };
+    size_t getPeak() { return peak; };
+};
+
+// Arenas are sized up front, running out of one means a size is wrong and the program cannot go on.
+[[noreturn]] void arenaExhausted(const char *what)
+{
+    cerr << "Arena full, cannot allocate " << what << endl;
+    exit(1);
+}
+
+Arena::Arena(size_t capacity)
+{
+    this->capacity = capacity;
+    buffer.reset(new char[capacity]);
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    if (start + size > capacity)
+    {
+        return nullptr;
+    }
+    used = start + size;
+    peak = max(peak, used);
+    return buffer.get() + start;
+}
+
+// Returns nullptr when the arena is full.
+template <typename T, typename... Args>
+T *Arena::create(Args... args)
+{
+    void *memory = allocate(sizeof(T), alignof(T));
+    return memory == nullptr ? nullptr : new (memory) T(args...);
+}
+
 class StrategyTree
 {
 private:
-    vector<string> moves;
+    Move move;
     StrategyTree *father;
-    map<string, StrategyTree *> sons;
-    void cutSon(string move) { sons.erase(move); };
+    // Sons are chained through nextSibling, every node lives in the arena of the root.
+    StrategyTree *firstSon = nullptr;
+    StrategyTree *lastSon = nullptr;
+    StrategyTree *nextSibling = nullptr;
+    Arena *arena;
+    void cutSon(Move move);
     bool forbiden = false;
     int winner = -1;
     int score = 0;
@@ -245,37 +545,36 @@ private:
 public:
     void forbid() { forbiden = true; };
     void incrementScore(int inc) { score += inc; };
-    void setOnlySon(string move);
+    void setOnlySon(Move move);
     StrategyTree *getBest();
     string getStrMoves();
     void setWinner(int w);
     int getScore() { return score; };
     bool getForbiden() { return forbiden; };
-    StrategyTree(StrategyTree *father);
+    StrategyTree(StrategyTree *father, Arena *arena);
     void doNotCome();
-    void setMoves(vector<string> m) { moves = m; };
-    StrategyTree *addSon(string move);
-    void insertMove(string move) { moves.push_back(move); };
+    StrategyTree *addSon(Move move);
     StrategyTree *getFather() { return father; };
     string prettyPrint(int depth);
-    vector<string> getMoves() { return moves; };
+    Move getMove() { return move; };
+    void setScore(int s) { score = s; };
+    int backUp();
 };
 
 StrategyTree *StrategyTree::getBest()
 {
     int best = -1000000;
-    string bestStr = "";
-    //cout << "Looking into the " << sons.size() << " sons." << endl;
-    for (auto it : sons)
+    StrategyTree *bestSon = nullptr;
+    for (StrategyTree *son = firstSon; son != nullptr; son = son->nextSibling)
     {
-        if (it.second->score > best)
+        if (son->score > best)
         {
-            best = it.second->score;
-            bestStr = it.first;
+            best = son->score;
+            bestSon = son;
         }
     }
-    // cout << "Best move was " << bestStr << " with " << best << endl;
-    return sons.at(bestStr);
+    // cout << "Best move was " << toString(bestSon->move) << " with " << best << endl;
+    return bestSon;
 }
 
 void StrategyTree::setWinner(int w)
@@ -312,44 +611,73 @@ void StrategyTree::setWinner(int w)
     // }
 }
 
-void StrategyTree::setOnlySon(string move)
+void StrategyTree::setOnlySon(Move move)
 {
-    // cout << "Called set only son with move " << move << " for tree ending with " << getStrMoves() << endl;
-    sons.clear();
+    // cout << "Called set only son with move " << toString(move) << " for tree ending with " << getStrMoves() << endl;
+    firstSon = nullptr;
+    lastSon = nullptr;
     addSon(move);
-    // cout << "Now, " << getStrMoves() << " only has " << sons.size() << " son." << endl;
 };
 
 string StrategyTree::getStrMoves()
 {
     string ret = "";
-    for (string m : getMoves())
+    for (StrategyTree *node = this; node->father != nullptr; node = node->father)
     {
-        ret += m + " --> ";
+        ret = toString(node->move) + " --> " + ret;
     }
     return ret;
 }
 
-StrategyTree *StrategyTree::addSon(string move)
+// Returns nullptr when the arena is full.
+StrategyTree *StrategyTree::addSon(Move move)
 {
-    StrategyTree *son = new StrategyTree(this);
-    son->setMoves(moves);
-    son->insertMove(move);
-    sons[move] = son;
+    StrategyTree *son = arena->create<StrategyTree>(this, arena);
+    if (son == nullptr)
+    {
+        return nullptr;
+    }
+    son->move = move;
+    if (lastSon == nullptr)
+    {
+        firstSon = son;
+    }
+    else
+    {
+        lastSon->nextSibling = son;
+    }
+    lastSon = son;
     return son;
 }
 
+void StrategyTree::cutSon(Move move)
+{
+    StrategyTree *previous = nullptr;
+    for (StrategyTree *son = firstSon; son != nullptr; previous = son, son = son->nextSibling)
+    {
+        if (son->move == move)
+        {
+            (previous == nullptr ? firstSon : previous->nextSibling) = son->nextSibling;
+            if (lastSon == son)
+            {
+                lastSon = previous;
+            }
+            return;
+        }
+    }
+}
+
 string StrategyTree::prettyPrint(int depth)
 {
     string ret = "";
-    if (moves.size() == 0)
+    if (father == nullptr)
     {
         ret += "Origin";
     }
-    for (auto it : sons)
+    for (StrategyTree *son = firstSon; son != nullptr; son = son->nextSibling)
     {
         string tabs(depth, '\t');
-        ret += "\n" + tabs + "|-" + it.first;
+        ret += "\n" + tabs + "|-" + toString(son->move);
         if (forbiden)
         {
             ret += " (F) ";
@@ -362,15 +690,32 @@ string StrategyTree::prettyPrint(int depth)
         {
             ret += " (L) ";
         }
-        ret += " [" + to_string(it.second->getScore()) + "] ";
-        ret += it.second->prettyPrint(depth + 1);
+        ret += " [" + to_string(son->getScore()) + "] ";
+        ret += son->prettyPrint(depth + 1);
     }
     return ret;
 }
 
-StrategyTree::StrategyTree(StrategyTree *f)
+// Gives every node with sons the negamax of their scores, the best son for the player to move decides.
+int StrategyTree::backUp()
+{
+    if (firstSon == nullptr)
+    {
+        return score;
+    }
+    int best = -1000000;
+    for (StrategyTree *son = firstSon; son != nullptr; son = son->nextSibling)
+    {
+        best = max(best, son->backUp());
+    }
+    score = -best;
+    return score;
+}
+
+StrategyTree::StrategyTree(StrategyTree *f, Arena *a)
 {
     father = f;
+    arena = a;
     score = 0;
 }
 
@@ -380,83 +725,143 @@ void StrategyTree::doNotCome()
     {
         if (father->father != nullptr)
         {
-            father->father->cutSon(moves.at(moves.size() - 2));
+            father->father->cutSon(father->move);
         }
     }
 }
 
+/**
+ * Fixed-width binary form of a position: who owns every square, then the orientations of the dice in
+ * square order from A8. Unused orientation bytes are 0.
+ */
+struct PositionRecord
+{
+    uint64_t occupancy[2];
+    uint8_t orientations[16];
+};
+static_assert(sizeof(PositionRecord) == 32, "position records are 32 bytes");
+
 class Board
 {
 private:
-    map<int, Die *> board;
-    Player *me;
-    Player *adv;
-    void getNeighbours(int position, int neighbours[4]);
-    void generateAllMoves(Die *d, int length, MoveTree *tree, vector<string> *moves);
-    map<char, string> oppo;
-    map<char, int> direc;
+    // occupancy[player] has a bit set for every square holding one of the player's dice.
+    uint64_t occupancy[2] = {0, 0};
+    // Only the squares set in occupancy hold a meaningful die.
+    Die dice[64];
+    Undo history[MAX_HISTORY];
+    unsigned historySize = 0;
+    // Zobrist hash of the dice, kept up to date by every change to the board.
+    uint64_t hash = 0;
 
 public:
-    Board()
-    {
-        me = new Player();
-        adv = new Player();
-        oppo['U'] = "D";
-        oppo['D'] = "U";
-        oppo['L'] = "R";
-        oppo['R'] = "L";
-        direc['U'] = UP;
-        direc['D'] = DOWN;
-        direc['L'] = LEFT;
-        direc['R'] = RIGHT;
-    }
-    void addDice(Die *d);
-    Board(string state);
+    int generateAllMoves(int position, Move *moves);
+    Board() {};
+    void addDice(int position, int owner, Die d);
+    bool parse(const char *state, size_t length);
+    bool toRecord(PositionRecord *record);
+    bool fromRecord(const PositionRecord &record);
     string exportState();
     void showBoard();
+    void showDice(int player);
     int toNumber(string position);
-    string toString(int position);
-    Die *rotation(Die *d, int direction);
+    Move toMove(string move);
+    bool rotation(int position, int direction, Die *eaten);
     void buildTree(int player, StrategyTree *tree, int depth);
-    Die *simulateMove(string move);
-    void revertMove(string move, string currentPos, Die *d);
+    bool makeMove(Move move);
+    void unmakeMove();
     void testGrid();
     void populate();
     void removeDice(int position);
-    void getMoves(int player, map<int, vector<string>> *allMoves);
+    int getMoves(int player, Move *moves);
+    bool findMove(int player, Board &target, Move *moves, Move *found);
     int isOver();
     void testManyTurns();
-    int getScore() { return me->nbDice() - adv->nbDice(); };
+    int getOwner(int position) { return (occupancy[1] >> position) & 1; };
+    uint64_t getHash() { return hash; };
+    Die getDie(int position) { return dice[position]; };
+    Board turned();
+    uint64_t getOccupancy(int player) { return occupancy[player]; };
+    bool isCapture(Move move) { return occupancy[1 - getOwner(move.from)] & squareMask(move.getDestination()); };
+    int nbDice(int player) { return __builtin_popcountll(occupancy[player]); };
+    int getScore() { return nbDice(0) - nbDice(1); };
+    int landingSquares(int player, uint64_t *reach);
+    int evaluate(int player);
 };
 
-void Board::revertMove(string move, string currentPos, Die *d)
+Move Board::toMove(string move)
+{
+    Move res;
+    res.from = toNumber(move.substr(0, 2));
+    for (char m : move.substr(3))
+    {
+        res.path |= toDirection(m) << (2 * res.length);
+        res.length++;
+    }
+    return res;
+}
+
+bool Board::makeMove(Move move)
 {
-    // Invert move:
-    string reverted = currentPos + " ";
-    string inv;
-    for (char c : move.substr(3))
+    int player = getOwner(move.from);
+    Die d = dice[move.from];
+    int position = move.from;
+    for (int i = 0; i < move.length; i++)
     {
-        inv = oppo.at(c) + inv;
+        int direction = move.getDirection(i);
+        d.rotate(direction);
+        position = step(position, direction);
     }
-    simulateMove(reverted + inv);
 
-    if (d == nullptr)
+    Undo &undo = history[historySize++ % MAX_HISTORY];
+    undo.from = move.from;
+    undo.to = position;
+    undo.previous = dice[move.from];
+    undo.captured = dice[position];
+    undo.capture = (occupancy[1 - player] & squareMask(position)) != 0;
+    undo.hash = hash;
+
+    hash ^= ZOBRIST.dice[player][move.from][undo.previous.getOrientation()];
+    hash ^= ZOBRIST.dice[player][position][d.getOrientation()];
+    if (undo.capture)
     {
-        return;
+        hash ^= ZOBRIST.dice[1 - player][position][undo.captured.getOrientation()];
     }
+    occupancy[1 - player] &= ~squareMask(position);
+    occupancy[player] ^= squareMask(move.from) | squareMask(position);
+    dice[position] = d;
+    return undo.capture;
+}
 
-    addDice(d);
+void Board::unmakeMove()
+{
+    Undo &undo = history[--historySize % MAX_HISTORY];
+    int player = getOwner(undo.to);
+    occupancy[player] ^= squareMask(undo.from) | squareMask(undo.to);
+    dice[undo.from] = undo.previous;
+    hash = undo.hash;
+    if (undo.capture)
+    {
+        occupancy[1 - player] |= squareMask(undo.to);
+        dice[undo.to] = undo.captured;
+    }
 }
 
-Die *Board::simulateMove(string move)
+// Looks for the move of player leading to target, hashes are compared first and the exported states confirm.
+bool Board::findMove(int player, Board &target, Move *moves, Move *found)
 {
-    Die *toMove = board.at(toNumber(move.substr(0, 2)));
-    Die *deleted;
-    for (char m : move.substr(3))
+    int count = getMoves(player, moves);
+    for (int i = 0; i < count; i++)
     {
-        deleted = rotation(toMove, direc.at(m));
+        makeMove(moves[i]);
+        bool same = hash == target.hash && exportState() == target.exportState();
+        unmakeMove();
+        if (same)
+        {
+            *found = moves[i];
+            return true;
+        }
     }
-    return deleted;
+    return false;
 }
 
 void Board::buildTree(int player, StrategyTree *tree, int depth)
@@ -465,19 +870,15 @@ void Board::buildTree(int player, StrategyTree *tree, int depth)
     {
         return;
     }
-    map<int, vector<string>> allMoves;
-    getMoves(player, &allMoves);
-    for (auto it : allMoves)
+    Move moves[MAX_DIE_MOVES];
+    for (uint64_t own = occupancy[player]; own; own &= own - 1)
     {
-        int position = it.first;
-        Die *d = board.at(position);
-        vector<string> moves = it.second;
-        for (int i = 0; i < moves.size(); i++)
+        int count = generateAllMoves(__builtin_ctzll(own), moves);
+        for (int i = 0; i < count; i++)
         {
-            string move = moves[i];
-            string tmpPosition = move.substr(0, 2);
+            Move move = moves[i];
 
-            Die *eaten = simulateMove(move);
+            bool captured = makeMove(move);
             int over = isOver();
             tree->setWinner(over);
 
@@ -485,10 +886,17 @@ void Board::buildTree(int player, StrategyTree *tree, int depth)
             // Continue simulating further the branch.
             if (over == -1)
             {
-                tree = tree->addSon(move);
-                if (eaten != nullptr)
+                StrategyTree *son = tree->addSon(move);
+                // The arena is full, the tree stops growing here.
+                if (son == nullptr)
+                {
+                    unmakeMove();
+                    return;
+                }
+                tree = son;
+                if (captured)
                 {
-                    tree->incrementScore(eaten->getOwner() * 2 - 1);
+                    tree->incrementScore((1 - player) * 2 - 1);
                 }
                 buildTree(player * -1 + 1, tree, depth - 1);
             }
@@ -501,7 +909,7 @@ void Board::buildTree(int player, StrategyTree *tree, int depth)
                 tree->forbid();
                 tree->setOnlySon(move);
                 tree->incrementScore(-1000);
-                revertMove(move, toString(d->getPosition()), eaten);
+                unmakeMove();
                 break;
             }
 
@@ -516,258 +924,2336 @@ void Board::buildTree(int player, StrategyTree *tree, int depth)
                 tree->forbid();
                 tree->setOnlySon(move);
                 tree->incrementScore(1000);
-                revertMove(move, toString(d->getPosition()), eaten);
+                unmakeMove();
                 break;
             }
             if (tree->getFather() != nullptr)
             {
                 tree = tree->getFather();
             }
-            revertMove(move, toString(d->getPosition()), eaten);
+            unmakeMove();
         }
     }
 }
 
-Board::Board(string state)
+// Reads an exported state in place, 6 characters per die: square, owner, top, front and right faces.
+bool Board::parse(const char *state, size_t length)
 {
-    me = new Player();
-    adv = new Player();
-    for (int i = 0; i < state.length(); i += 6)
+    for (size_t i = 0; i + 6 <= length; i += 6)
     {
-        int position = toNumber(state.substr(i, 2));
-        int owner = stoi(state.substr(i + 2, 1));
-        int top = stoi(state.substr(i + 3, 1));
-        int front = stoi(state.substr(i + 4, 1));
-        int right = stoi(state.substr(i + 5, 1));
-        addDice(new Die(position, owner, top, front, right));
+        const char *die = state + i;
+        if (die[0] < 'A' || die[0] > 'H' || die[1] < '1' || die[1] > '8' || (die[2] != '0' && die[2] != '1') ||
+            die[3] < '1' || die[3] > '6' || die[4] < '1' || die[4] > '6' || die[5] < '1' || die[5] > '6')
+        {
+            return false;
+        }
+        int position = die[0] - 'A' + 56 - 8 * (die[1] - '1');
+        addDice(position, die[2] - '0', Die(die[3] - '0', die[4] - '0', die[5] - '0'));
     }
+    return length % 6 == 0;
 }
 
-string Board::exportState()
+/**
+ * Squares every die of player can land on, reach[i] for the i-th die from A8. The walk goes through empty squares
+ * only but may come back on itself, a superset of the real moves which only needs shifts of whole bitboards.
+ * The dice walk side by side in branch-free lanes, a die stops once it made as many steps as its top face.
+ */
+int Board::landingSquares(int player, uint64_t *reach)
 {
-    string res = "";
-    for (auto it : board)
+    uint64_t empty = ~(occupancy[0] | occupancy[1]);
+    uint64_t notOwn = ~occupancy[player];
+    uint64_t frontier[8] = {};
+    int length[8] = {};
+    int count = 0;
+    for (uint64_t own = occupancy[player]; own && count < 8; own &= own - 1)
     {
-        Die *d = it.second;
-        res += toString(d->getPosition()) + to_string(d->getOwner()) + to_string(d->getFaceup()) + to_string(d->getFacefront()) + to_string(d->getFaceright());
+        int position = __builtin_ctzll(own);
+        frontier[count] = squareMask(position);
+        length[count] = dice[position].getFaceup();
+        count++;
     }
-    return res;
-}
-
-void Board::removeDice(int position)
-{
-    Die *d = board.at(position);
-    board.erase(position);
-    if (d->getOwner() == 0)
+    for (int i = 0; i < 8; i++)
     {
-        me->removeDie(d->getUniqueID());
+        reach[i] = 0;
     }
-    else if (d->getOwner() == 1)
+    for (int step = 1; step <= 6; step++)
     {
-        adv->removeDie(d->getUniqueID());
+        for (int i = 0; i < 8; i++)
+        {
+            uint64_t f = frontier[i];
+            uint64_t spread = (f >> 8) | (f << 8) | ((f >> 1) & ~FILE_H) | ((f << 1) & ~FILE_A);
+            uint64_t walking = -(uint64_t)(step < length[i]);
+            uint64_t landing = -(uint64_t)(step == length[i]);
+            reach[i] |= spread & notOwn & landing;
+            frontier[i] = spread & empty & walking;
+        }
     }
+    return count;
 }
 
-int Board::isOver()
+// Static value for player: dice first, then mobility, squares controlled and dice under threat.
+int Board::evaluate(int player)
 {
-    if (me->nbDice() == 0)
-    {
-        return 1;
-    }
-    else if (adv->nbDice() == 0)
+    uint64_t reach[2][8];
+    uint64_t controlled[2] = {0, 0};
+    int mobility[2] = {0, 0};
+    for (int p = 0; p < 2; p++)
     {
-        return 0;
+        landingSquares(p, reach[p]);
+        for (int i = 0; i < 8; i++)
+        {
+            controlled[p] |= reach[p][i];
+            mobility[p] += __builtin_popcountll(reach[p][i]);
+        }
     }
-    return -1;
+    int opponent = 1 - player;
+    return DIE_VALUE * (nbDice(player) - nbDice(opponent)) +
+           MOBILITY_WEIGHT * (mobility[player] - mobility[opponent]) +
+           CONTROL_WEIGHT * (__builtin_popcountll(controlled[player]) - __builtin_popcountll(controlled[opponent])) +
+           THREAT_WEIGHT * __builtin_popcountll(controlled[player] & occupancy[opponent]) -
+           HANGING_WEIGHT * __builtin_popcountll(controlled[opponent] & occupancy[player]);
 }
 
-void Board::addDice(Die *d)
+// Fails when there are more dice than a record holds.
+bool Board::toRecord(PositionRecord *record)
 {
-    // cout << "Adding dice for " << d->getOwner() << " at " << toString(d->getPosition()) << endl;
-    this->board[d->getPosition()] = d;
-    if (d->getOwner() == 0)
+    uint64_t occupied = occupancy[0] | occupancy[1];
+    if (__builtin_popcountll(occupied) > 16)
     {
-        this->me->addDie(d);
+        return false;
     }
-    else if (d->getOwner() == 1)
+    record->occupancy[0] = occupancy[0];
+    record->occupancy[1] = occupancy[1];
+    memset(record->orientations, 0, sizeof(record->orientations));
+    for (int i = 0; occupied; occupied &= occupied - 1, i++)
     {
-        this->adv->addDie(d);
+        record->orientations[i] = dice[__builtin_ctzll(occupied)].getOrientation();
     }
+    return true;
 }
 
-Die *Board::rotation(Die *d, int direction)
+// The board must be empty, records from another source are checked first.
+bool Board::fromRecord(const PositionRecord &record)
 {
-    int tmpPosition = d->getPosition();
-    d->rotate(direction);
-    if (this->board.find(d->getPosition()) != board.end())
+    uint64_t occupied = record.occupancy[0] | record.occupancy[1];
+    if ((record.occupancy[0] & record.occupancy[1]) || __builtin_popcountll(occupied) > 16)
     {
-        Die *col = this->board[d->getPosition()];
-        if (d->getOwner() == col->getOwner())
-        {
-            cout << "Tried to eat yourself at " << toString(col->getPosition()) << "! Owner is " << d->getOwner() << endl;
-        }
-        else
+        return false;
+    }
+    for (int i = 0; occupied; occupied &= occupied - 1, i++)
+    {
+        int position = __builtin_ctzll(occupied);
+        if (record.orientations[i] >= 24)
         {
-            if (col->getOwner() != d->getOwner())
-            {
-                Die *advDie = board.at(col->getPosition());
-                this->removeDice(col->getPosition());
-                this->board[col->getPosition()] = d;
-                this->board.erase(tmpPosition);
-                return advDie;
-            }
+            return false;
         }
+        addDice(position, (record.occupancy[1] >> position) & 1, Die(record.orientations[i]));
     }
-    else
+    return true;
+}
+
+// The same position seen from the other side of the table: squares and dice are turned by 180 degrees.
+Board Board::turned()
+{
+    Board res;
+    for (uint64_t occupied = occupancy[0] | occupancy[1]; occupied; occupied &= occupied - 1)
     {
-        this->board[d->getPosition()] = d;
-        this->board.erase(tmpPosition);
+        int position = __builtin_ctzll(occupied);
+        const uint8_t *faces = ORIENTATIONS.faces[dice[position].getOrientation()];
+        // Up stays, the back comes to the front and the left to the right.
+        res.addDice(63 - position, getOwner(position), Die(faces[0], faces[3], faces[4]));
     }
-    return nullptr;
+    return res;
 }
 
-void Board::getNeighbours(int position, int neighbours[4])
+string Board::exportState()
 {
-    if (position - 8 < 0)
+    string res = "";
+    for (uint64_t occupied = occupancy[0] | occupancy[1]; occupied; occupied &= occupied - 1)
     {
-        neighbours[UP] = 2;
+        int position = __builtin_ctzll(occupied);
+        Die &d = dice[position];
+        res += toString(position) + to_string(getOwner(position)) + to_string(d.getFaceup()) + to_string(d.getFacefront()) + to_string(d.getFaceright());
     }
-    else if (board.find(position - 8) != board.end())
+    return res;
+}
+
+void Board::removeDice(int position)
+{
+    if ((occupancy[0] | occupancy[1]) & squareMask(position))
     {
-        neighbours[UP] = board.at(position - 8)->getOwner();
+        hash ^= ZOBRIST.dice[getOwner(position)][position][dice[position].getOrientation()];
     }
+    occupancy[0] &= ~squareMask(position);
+    occupancy[1] &= ~squareMask(position);
+}
 
-    if (position + 8 > 63)
+int Board::isOver()
+{
+    if (occupancy[0] == 0)
     {
-        neighbours[DOWN] = 2;
+        return 1;
     }
-    else if (board.find(position + 8) != board.end())
+    else if (occupancy[1] == 0)
     {
-        neighbours[DOWN] = board.at(position + 8)->getOwner();
+        return 0;
     }
+    return -1;
+}
 
-    if (position % 8 == 7)
+void Board::addDice(int position, int owner, Die d)
+{
+    // cout << "Adding dice for " << owner << " at " << toString(position) << endl;
+    removeDice(position);
+    dice[position] = d;
+    occupancy[owner] |= squareMask(position);
+    hash ^= ZOBRIST.dice[owner][position][d.getOrientation()];
+}
+
+bool Board::rotation(int position, int direction, Die *eaten)
+{
+    Die d = dice[position];
+    int player = getOwner(position);
+    d.rotate(direction);
+    int target = step(position, direction);
+    bool captured = false;
+    if (occupancy[player] & squareMask(target))
+    {
+        cout << "Tried to eat yourself at " << toString(target) << "! Owner is " << player << endl;
+        return false;
+    }
+    if (occupancy[1 - player] & squareMask(target))
+    {
+        if (eaten != nullptr)
+        {
+            *eaten = dice[target];
+        }
+        captured = true;
+    }
+    removeDice(position);
+    addDice(target, player, d);
+    return captured;
+}
+
+int Board::generateAllMoves(int position, Move *moves)
+{
+    int player = getOwner(position);
+    int length = dice[position].getFaceup();
+    uint64_t occupied = occupancy[0] | occupancy[1];
+    uint64_t own = occupancy[player];
+    if (!(WALKS.getEndpoints(position, length) & ~own))
+    {
+        return 0;
+    }
+
+    // Every walk is written out and only kept when legal, so the loop has no branch to mispredict.
+    const Walk *walks = WALKS.getWalks(position, length);
+    int total = WALKS.getCount(position, length);
+    int count = 0;
+    for (int i = 0; i < total; i++)
+    {
+        moves[count].path = walks[i].path;
+        moves[count].from = position;
+        moves[count].length = length;
+        count += !(walks[i].through & occupied) && !(own & squareMask(walks[i].to));
+    }
+    return count;
+}
+
+int Board::getMoves(int player, Move *moves)
+{
+    int count = 0;
+    for (uint64_t own = occupancy[player]; own; own &= own - 1)
+    {
+        count += generateAllMoves(__builtin_ctzll(own), moves + count);
+    }
+    return count;
+}
+
+void Board::populate()
+{
+    this->addDice(32, 0, Die(4, 3, 1));
+    this->addDice(56, 1, Die(4, 2, 6));
+    this->addDice(57, 1, Die(6, 3, 4));
+}
+
+int Board::toNumber(string position)
+{
+    return position.at(0) - 65 + 56 - 8 * (position.at(1) - 49);
+};
+
+void Board::showBoard()
+{
+    string res = "  |A B C D E F G H\n";
+    res += "--+---------------\n";
+    for (int i = 0; i < 8; i++)
+    {
+        res += 56 - i;
+        res += " |";
+        for (int j = 0; j < 8; j++)
+        {
+            if ((occupancy[0] | occupancy[1]) & squareMask(i * 8 + j))
+            {
+                res += to_string(dice[i * 8 + j].getFaceup());
+                res += " ";
+            }
+            else
+            {
+                res += "  ";
+            }
+        }
+        res += "\n";
+    }
+    cout << res << endl;
+}
+
+void Board::showDice(int player)
+{
+    for (uint64_t own = occupancy[player]; own; own &= own - 1)
+    {
+        int position = __builtin_ctzll(own);
+        cout << player << ": " << dice[position].getFaceup() << " at " << position << endl;
+    }
+}
+
+// Scores are in hundredths of a die (see DIE_VALUE), a won game is worth more than any position. Scores must fit in 16 bits.
+const int WIN_SCORE = 30000;
+const int MAX_PLY = 32;
+const int SEARCH_DEPTH = 3;
+// Milliseconds per turn, leaving a margin under the referee's limits.
+const int FIRST_TURN_BUDGET_MS = 900;
+const int TURN_BUDGET_MS = 45;
+// A ponder search keeps the core busy until the turn arrives, so the turn keeps a wider margin.
+const int PONDER_TURN_BUDGET_MS = 40;
+// The clock is read once every CLOCK_CHECK_INTERVAL nodes.
+const long CLOCK_CHECK_INTERVAL = 256;
+// The transposition table has 2^TABLE_SIZE_LOG2 entries of 16 bytes.
+const int TABLE_SIZE_LOG2 = 20;
+// The tablebase covers one die against one, a die state is its square and orientation.
+const int TABLEBASE_DIE_STATES = 64 * 24;
+const size_t TABLEBASE_SIZE = (size_t)TABLEBASE_DIE_STATES * TABLEBASE_DIE_STATES;
+const char TABLEBASE_MAGIC[8] = {'D', 'I', 'C', 'E', 'T', 'B', '1', 0};
+const char BOOK_MAGIC[8] = {'D', 'I', 'C', 'E', 'B', 'K', '1', 0};
+const char POSITIONS_MAGIC[8] = {'D', 'I', 'C', 'E', 'P', 'S', '1', 0};
+// Monte Carlo settings: node pool size, UCT exploration constant and plies played randomly before counting dice.
+const int MCTS_NODES = 1 << 20;
+const float MCTS_EXPLORATION = 1.4;
+const int MCTS_PLAYOUT_DEPTH = 30;
+// The Monte Carlo tree outlives the turn arena, it gets its own memory.
+const size_t MCTS_ARENA_SIZE = 32 << 20;
+// Self-play games give each engine a smaller table, and stop after SELF_PLAY_MAX_PLIES plies.
+const int SELF_PLAY_TABLE_SIZE_LOG2 = 18;
+const int SELF_PLAY_MAX_PLIES = 200;
+// Reference counts of the perft suite, player 0 to move.
+struct PerftCase
+{
+    const char *state;
+    int depth;
+    long leaves;
+};
+const PerftCase PERFT_SUITE[] = {
+    {"A80431B80124G11513", 1, 13},
+    {"A80431B80124G11513", 2, 1118},
+    {"A80431B80124G11513", 3, 83208},
+    {"A80431B80124G11513A10634C30412H10264D50521", 1, 378},
+    {"A80431B80124G11513A10634C30412H10264D50521", 2, 25771},
+    {"A80431B80124G11513A10634C30412H10264D50521", 3, 7168497},
+    {"A80314B80124C80513D80634E80412F80264G80521H80426A11143B11215C11653D11536E11431F11152G11642H11562", 1, 239},
+    {"A80314B80124C80513D80634E80412F80264G80521H80426A11143B11215C11653D11536E11431F11152G11642H11562", 2, 66589},
+    {"A80314B80124C80513D80634E80412F80264G80521H80426A11143B11215C11653D11536E11431F11152G11642H11562", 3, 16292121},
+};
+// The turn input is read in blocks of this size.
+const size_t TURN_BUFFER_SIZE = 1 << 16;
+// Batch workers take this many lines at a time.
+const size_t BATCH_CHUNK = 16;
+// Batch input is scored this many bytes at a time, so memory does not grow with the dataset.
+const size_t BATCH_BLOCK = 1 << 22;
+// The analysis keeps this many plies in its tree, the subtrees below are the work items.
+const int ANALYSIS_SPLIT_DEPTH = 2;
+// Bytes reserved for the allocations of a turn, a search takes about 2.5MB of it.
+// The stdin loop adds room for every thread on top, see Search::getArenaBytes.
+const size_t ARENA_SIZE = 64 << 20;
+// --threads accepts at most this many threads.
+const int MAX_THREADS = 256;
+// Move ordering ranks, highest first. Quiet moves which are not killers are ranked by their history score,
+// which is halved everywhere before it reaches the killers.
+const uint32_t ORDER_PV = 1 << 30;
+const uint32_t ORDER_HASH = 1 << 29;
+const uint32_t ORDER_WINNING_CAPTURE = 1 << 28;
+const uint32_t ORDER_CAPTURE = 1 << 27;
+const uint32_t ORDER_KILLER = 1 << 26;
+const int HISTORY_LIMIT = 1 << 25;
+// The first moves are picked one at a time, the rest is only sorted when no cutoff came early.
+const int SELECTION_PICKS = 4;
+
+// Counters of the instrumented build, see DICE_STATS.
+struct SearchStats
+{
+    long generations = 0;
+    long diceGenerated = 0;
+    long movesGenerated = 0;
+    // Nodes whose moves were searched, and how many of them ended on a beta cutoff.
+    long expanded = 0;
+    long cutoffs = 0;
+    long probes = 0;
+    long hits = 0;
+    long generationNanos = 0;
+    long evaluationNanos = 0;
+    void add(const SearchStats &other);
+};
+
+void SearchStats::add(const SearchStats &other)
+{
+    generations += other.generations;
+    diceGenerated += other.diceGenerated;
+    movesGenerated += other.movesGenerated;
+    expanded += other.expanded;
+    cutoffs += other.cutoffs;
+    probes += other.probes;
+    hits += other.hits;
+    generationNanos += other.generationNanos;
+    evaluationNanos += other.evaluationNanos;
+}
+
+/**
+ * Hands out the time of each turn, the first turn gets a longer budget than the others.
+ */
+class TimeControl
+{
+private:
+    int firstTurnBudget;
+    int turnBudget;
+    int turn = 0;
+
+public:
+    TimeControl(int firstTurnBudget, int turnBudget)
+    {
+        this->firstTurnBudget = firstTurnBudget;
+        this->turnBudget = turnBudget;
+    };
+    chrono::steady_clock::time_point startTurn();
+};
+
+chrono::steady_clock::time_point TimeControl::startTurn()
+{
+    int budget = turn++ == 0 ? firstTurnBudget : turnBudget;
+    return chrono::steady_clock::now() + chrono::milliseconds(budget);
+}
+
+enum Bound
+{
+    EXACT,
+    LOWER,
+    UPPER
+};
+
+struct TableEntry
+{
+    Move move;
+    int score;
+    int depth;
+    int bound;
+};
+
+/**
+ * Fixed-size, power-of-two transposition table, one entry per slot and always replaced.
+ * An entry is two words, the data and the key xored with the data, so a slot half written by another
+ * thread just fails the key check instead of handing out a wrong move or score.
+ */
+class TranspositionTable
+{
+private:
+    struct Slot
+    {
+        atomic<uint64_t> check;
+        atomic<uint64_t> data;
+    };
+    unique_ptr<Slot[]> slots;
+    uint64_t mask;
+
+public:
+    TranspositionTable(int sizeLog2);
+    bool probe(uint64_t key, TableEntry *entry);
+    void store(uint64_t key, Move move, int score, int depth, int bound);
+    void clear();
+};
+
+TranspositionTable::TranspositionTable(int sizeLog2)
+{
+    mask = (1ULL << sizeLog2) - 1;
+    slots.reset(new Slot[mask + 1]);
+    clear();
+}
+
+void TranspositionTable::clear()
+{
+    for (uint64_t i = 0; i <= mask; i++)
+    {
+        slots[i].check.store(0, memory_order_relaxed);
+        slots[i].data.store(0, memory_order_relaxed);
+    }
+}
+
+bool TranspositionTable::probe(uint64_t key, TableEntry *entry)
+{
+    Slot &slot = slots[key & mask];
+    uint64_t data = slot.data.load(memory_order_relaxed);
+    if ((slot.check.load(memory_order_relaxed) ^ data) != key)
+    {
+        return false;
+    }
+    entry->move = Move::unpack(data & 0xFFFFFFFF);
+    entry->score = (int16_t)((data >> 32) & 0xFFFF);
+    entry->depth = (data >> 48) & 0xFF;
+    entry->bound = (data >> 56) & 0xFF;
+    return true;
+}
+
+void TranspositionTable::store(uint64_t key, Move move, int score, int depth, int bound)
+{
+    uint64_t data = move.pack() | (uint64_t)(uint16_t)score << 32 | (uint64_t)depth << 48 | (uint64_t)bound << 56;
+    Slot &slot = slots[key & mask];
+    slot.check.store(key ^ data, memory_order_relaxed);
+    slot.data.store(data, memory_order_relaxed);
+}
+
+/**
+ * A whole file mapped read-only in memory, pages are only read when touched.
+ */
+class MappedFile
+{
+private:
+    void *mapping = nullptr;
+    size_t size = 0;
+
+public:
+    MappedFile() {};
+    ~MappedFile();
+    bool open(string path);
+    const uint8_t *getData() { return (const uint8_t *)mapping; };
+    size_t getSize() { return size; };
+};
+
+MappedFile::~MappedFile()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, size);
+    }
+}
+
+bool MappedFile::open(string path)
+{
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file == -1)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        size = info.st_size;
+        mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+        }
+    }
+    close(file);
+    return mapping != nullptr;
+}
+
+/**
+ * Appends positions to a file of PositionRecords behind POSITIONS_MAGIC.
+ */
+class PositionWriter
+{
+private:
+    FILE *file = nullptr;
+    size_t count = 0;
+
+public:
+    PositionWriter() {};
+    ~PositionWriter() { close(); };
+    bool open(string path);
+    bool write(Board &board);
+    bool close();
+    size_t getCount() { return count; };
+};
+
+bool PositionWriter::open(string path)
+{
+    file = fopen(path.c_str(), "wb");
+    return file != nullptr && fwrite(POSITIONS_MAGIC, 1, sizeof(POSITIONS_MAGIC), file) == sizeof(POSITIONS_MAGIC);
+}
+
+bool PositionWriter::write(Board &board)
+{
+    PositionRecord record;
+    if (file == nullptr || !board.toRecord(&record) || fwrite(&record, sizeof(record), 1, file) != 1)
+    {
+        return false;
+    }
+    count++;
+    return true;
+}
+
+bool PositionWriter::close()
+{
+    bool closed = file == nullptr || fclose(file) == 0;
+    file = nullptr;
+    return closed;
+}
+
+/**
+ * Reads a file written by PositionWriter in place: records are fixed width, so any of them is one index away.
+ */
+class PositionFile
+{
+private:
+    MappedFile file;
+    const PositionRecord *records = nullptr;
+    size_t count = 0;
+
+public:
+    bool open(string path);
+    size_t size() { return count; };
+    const PositionRecord &getRecord(size_t index) { return records[index]; };
+    bool getBoard(size_t index, Board *board) { return board->fromRecord(records[index]); };
+};
+
+bool PositionFile::open(string path)
+{
+    if (!file.open(path) || file.getSize() < sizeof(POSITIONS_MAGIC) ||
+        memcmp(file.getData(), POSITIONS_MAGIC, sizeof(POSITIONS_MAGIC)) != 0 ||
+        (file.getSize() - sizeof(POSITIONS_MAGIC)) % sizeof(PositionRecord) != 0)
+    {
+        return false;
+    }
+    records = (const PositionRecord *)(file.getData() + sizeof(POSITIONS_MAGIC));
+    count = (file.getSize() - sizeof(POSITIONS_MAGIC)) / sizeof(PositionRecord);
+    return true;
+}
+
+/**
+ * Endgame tablebase of every position with one die per side, built offline by retrograde analysis.
+ * A position is indexed from the side to move: (square * 24 + orientation) of the mover's die, then of the other die.
+ * Each byte holds 0 for a draw, n below 128 for a win in n plies and 128 + n for a loss in n plies.
+ * Larger material does not fit: two dice against one is already 64 * 24 times bigger.
+ */
+class Tablebase
+{
+private:
+    MappedFile file;
+    const uint8_t *data = nullptr;
+    static int index(int mover, int other) { return mover * TABLEBASE_DIE_STATES + other; };
+    template <typename Visit>
+    static void walkForward(int square, int orientation, int blocked, uint64_t visited, int left, Visit &visit);
+    template <typename Visit>
+    static void walkBackward(int square, int orientation, int blocked, uint64_t visited, int length, Visit &visit);
+
+public:
+    Tablebase() {};
+    static bool generate(string path);
+    bool open(string path);
+    bool probe(Board &board, int player, int ply, int *score);
+    Move bestMove(Board &board, int player, Move *moves);
+};
+
+// Every path of left steps from square, the die can only stop on blocked, the other die, at the last step.
+template <typename Visit>
+void Tablebase::walkForward(int square, int orientation, int blocked, uint64_t visited, int left, Visit &visit)
+{
+    for (int direction = 0; direction < 4; direction++)
+    {
+        int next = NEIGHBOURS.square[square][direction];
+        if (next == -1 || (visited & squareMask(next)) || (left > 1 && next == blocked))
+        {
+            continue;
+        }
+        int rolled = ORIENTATIONS.roll[orientation][direction];
+        if (left == 1)
+        {
+            visit(next, rolled);
+        }
+        else
+        {
+            walkForward(next, rolled, blocked, visited | squareMask(next), left - 1, visit);
+        }
+    }
+}
+
+// Unrolls the die from square back to every start of a quiet move ending there: a walk of length steps
+// whose first square had length on top.
+template <typename Visit>
+void Tablebase::walkBackward(int square, int orientation, int blocked, uint64_t visited, int length, Visit &visit)
+{
+    for (int direction = 0; direction < 4; direction++)
+    {
+        int previous = NEIGHBOURS.square[square][direction];
+        if (previous == -1 || previous == blocked || (visited & squareMask(previous)))
+        {
+            continue;
+        }
+        int rolled = ORIENTATIONS.roll[orientation][direction];
+        if (ORIENTATIONS.faces[rolled][0] == length + 1)
+        {
+            visit(previous, rolled);
+        }
+        if (length + 1 < 6)
+        {
+            walkBackward(previous, rolled, blocked, visited | squareMask(previous), length + 1, visit);
+        }
+    }
+}
+
+/**
+ * Positions with a capture are won in one ply and seed the queue. Walking the queue in order of distance,
+ * a lost position makes all its parents won one ply later, and a parent whose children are all won is lost.
+ * What never gets resolved is a draw, so are positions without any move.
+ */
+bool Tablebase::generate(string path)
+{
+    vector<uint8_t> values(TABLEBASE_SIZE, 0);
+    vector<uint16_t> children(TABLEBASE_SIZE, 0);
+    vector<int> queue;
+    // stamp[die state] == current when the state was already seen from the current position.
+    vector<int> stamp(TABLEBASE_DIE_STATES, -1);
+    int current = 0;
+
+    for (int mover = 0; mover < TABLEBASE_DIE_STATES; mover++)
+    {
+        for (int other = 0; other < TABLEBASE_DIE_STATES; other++)
+        {
+            int moverSquare = mover / 24;
+            int otherSquare = other / 24;
+            if (moverSquare == otherSquare)
+            {
+                continue;
+            }
+            current++;
+            bool capture = false;
+            int count = 0;
+            auto visit = [&](int square, int orientation)
+            {
+                if (square == otherSquare)
+                {
+                    capture = true;
+                }
+                else if (stamp[square * 24 + orientation] != current)
+                {
+                    stamp[square * 24 + orientation] = current;
+                    count++;
+                }
+            };
+            int orientation = mover % 24;
+            walkForward(moverSquare, orientation, otherSquare, squareMask(moverSquare), ORIENTATIONS.faces[orientation][0], visit);
+            if (capture)
+            {
+                values[index(mover, other)] = 1;
+                queue.push_back(index(mover, other));
+            }
+            children[index(mover, other)] = count;
+        }
+    }
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        int position = queue[head];
+        uint8_t value = values[position];
+        bool lost = value > 128;
+        int distance = (lost ? value - 128 : value) + 1;
+        if (distance >= 128)
+        {
+            cerr << "Distance to the end does not fit in the tablebase" << endl;
+            return false;
+        }
+        // The other die has just moved, in the parent it was the mover.
+        int mover = position / TABLEBASE_DIE_STATES;
+        int other = position % TABLEBASE_DIE_STATES;
+        current++;
+        auto visit = [&](int square, int orientation)
+        {
+            int state = square * 24 + orientation;
+            if (stamp[state] == current)
+            {
+                return;
+            }
+            stamp[state] = current;
+            int parent = index(state, mover);
+            if (values[parent] != 0)
+            {
+                return;
+            }
+            if (lost)
+            {
+                values[parent] = distance;
+                queue.push_back(parent);
+            }
+            else if (--children[parent] == 0)
+            {
+                values[parent] = 128 + distance;
+                queue.push_back(parent);
+            }
+        };
+        walkBackward(other / 24, other % 24, mover / 24, squareMask(other / 24), 0, visit);
+    }
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        cerr << "Cannot write " << path << endl;
+        return false;
+    }
+    bool written = fwrite(TABLEBASE_MAGIC, 1, sizeof(TABLEBASE_MAGIC), file) == sizeof(TABLEBASE_MAGIC) &&
+                   fwrite(values.data(), 1, values.size(), file) == values.size();
+    fclose(file);
+    cout << queue.size() << " decided positions out of " << TABLEBASE_SIZE << endl;
+    return written;
+}
+
+bool Tablebase::open(string path)
+{
+    if (!file.open(path) || file.getSize() != sizeof(TABLEBASE_MAGIC) + TABLEBASE_SIZE ||
+        memcmp(file.getData(), TABLEBASE_MAGIC, sizeof(TABLEBASE_MAGIC)) != 0)
+    {
+        return false;
+    }
+    data = file.getData() + sizeof(TABLEBASE_MAGIC);
+    return true;
+}
+
+// Scores follow the search: a win in n plies seen at ply is worth WIN_SCORE - ply - n, kept above WIN_SCORE - MAX_PLY.
+bool Tablebase::probe(Board &board, int player, int ply, int *score)
+{
+    if (data == nullptr || board.nbDice(player) != 1 || board.nbDice(1 - player) != 1)
+    {
+        return false;
+    }
+    int moverSquare = __builtin_ctzll(board.getOccupancy(player));
+    int otherSquare = __builtin_ctzll(board.getOccupancy(1 - player));
+    uint8_t value = data[index(moverSquare * 24 + board.getDie(moverSquare).getOrientation(),
+                               otherSquare * 24 + board.getDie(otherSquare).getOrientation())];
+    if (value == 0)
+    {
+        *score = 0;
+    }
+    else
+    {
+        int won = max(WIN_SCORE - ply - (value & 127), WIN_SCORE - MAX_PLY + 1);
+        *score = value < 128 ? won : -won;
+    }
+    return true;
+}
+
+// The move keeping the best tablebase value, the position must be in the tablebase.
+Move Tablebase::bestMove(Board &board, int player, Move *moves)
+{
+    int count = board.getMoves(player, moves);
+    Move best;
+    int bestScore = -WIN_SCORE;
+    for (int i = 0; i < count; i++)
+    {
+        if (board.isCapture(moves[i]))
+        {
+            return moves[i];
+        }
+        board.makeMove(moves[i]);
+        int score;
+        probe(board, 1 - player, 1, &score);
+        board.unmakeMove();
+        if (-score > bestScore)
+        {
+            bestScore = -score;
+            best = moves[i];
+        }
+    }
+    return best;
+}
+
+/**
+ * Negamax with alpha-beta pruning, deepened one ply at a time.
+ * Works on its own copy of the board, every score is seen from the player to move.
+ */
+class Search
+{
+private:
+    Board board;
+    TranspositionTable *table;
+    // pv[ply] is the best line found from ply, pvLength[ply] its length.
+    Move pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY];
+    Move principalVariation[MAX_PLY];
+    int principalLength = 0;
+    // Generated and ordered moves of each ply, taken from the turn's arena.
+    Move *moveBuffers[MAX_PLY];
+    uint64_t *orderBuffers[MAX_PLY];
+    // False when the arena could not hold the buffers, such a search must not run.
+    bool ready = true;
+    // Still walking down the previous iteration's line.
+    bool followPV = false;
+    int score = 0;
+    int depthReached = 0;
+    long nodes = 0;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+    bool stopped = false;
+    // Two quiet moves per ply which caused a beta cutoff, and cutoff counts per player, origin and destination.
+    Move killers[MAX_PLY][2];
+    int history[2][64][64] = {};
+    // Lazy SMP helpers have an index above 0, any search stops as soon as stopSignal is raised.
+    int helperIndex = 0;
+    atomic<bool> *stopSignal = nullptr;
+    Tablebase *tablebase = nullptr;
+    bool outOfTime();
+    void scoreMoves(int player, int ply, Move *moves, int count, Move pvMove, Move hashMove, uint64_t *ordered);
+    Move pickMove(uint64_t *ordered, int count, int i);
+    void rememberCutoff(int player, int ply, int depth, Move move);
+    int negamax(int player, int depth, int ply, int alpha, int beta);
+    int evaluate(int player);
+#ifdef DICE_STATS
+    SearchStats stats;
+#endif
+
+public:
+    Search(Board board, TranspositionTable *table, Arena *arena);
+    void setDeadline(chrono::steady_clock::time_point deadline) { this->deadline = deadline; };
+    void setHelper(int helperIndex, atomic<bool> *stopSignal);
+    void setStopSignal(atomic<bool> *stopSignal) { this->stopSignal = stopSignal; };
+    void setTablebase(Tablebase *tablebase) { this->tablebase = tablebase; };
+    Move iterate(int player, int maxDepth);
+    vector<Move> getPrincipalVariation() { return vector<Move>(principalVariation, principalVariation + principalLength); };
+    int getScore() { return score; };
+    int getDepth() { return depthReached; };
+    int solve(Board position, int player, int depth, int ply);
+    long getNodes() { return nodes; };
+    bool isReady() { return ready; };
+    static size_t getArenaBytes();
+#ifdef DICE_STATS
+    SearchStats getStats() { return stats; };
+#endif
+};
+
+Search::Search(Board board, TranspositionTable *table, Arena *arena)
+{
+    this->board = board;
+    this->table = table;
+    for (int ply = 0; ply < MAX_PLY; ply++)
+    {
+        moveBuffers[ply] = arena->allocateArray<Move>(MAX_MOVES);
+        orderBuffers[ply] = arena->allocateArray<uint64_t>(MAX_MOVES);
+        ready = ready && moveBuffers[ply] != nullptr && orderBuffers[ply] != nullptr;
+    }
+}
+
+// Upper bound of what one search takes from an arena, alignment padding included.
+size_t Search::getArenaBytes()
+{
+    return sizeof(Search) + alignof(Search) + MAX_PLY * (MAX_MOVES * (sizeof(Move) + sizeof(uint64_t)) + alignof(Move) + alignof(uint64_t));
+}
+
+void Search::setHelper(int helperIndex, atomic<bool> *stopSignal)
+{
+    this->helperIndex = helperIndex;
+    this->stopSignal = stopSignal;
+}
+
+bool Search::outOfTime()
+{
+    if (!stopped && stopSignal != nullptr && stopSignal->load(memory_order_relaxed))
+    {
+        stopped = true;
+    }
+    // The first iteration of the main search always completes so there is a move to play.
+    if (!stopped && (depthReached > 0 || helperIndex > 0) && nodes % CLOCK_CHECK_INTERVAL == 0)
+    {
+        stopped = chrono::steady_clock::now() >= deadline;
+    }
+    return stopped;
+}
+
+void Search::scoreMoves(int player, int ply, Move *moves, int count, Move pvMove, Move hashMove, uint64_t *ordered)
+{
+    uint64_t opponent = board.getOccupancy(1 - player);
+    bool lastDie = board.nbDice(1 - player) == 1;
+    for (int i = 0; i < count; i++)
+    {
+        Move move = moves[i];
+        int to = move.getDestination();
+        uint32_t rank;
+        if (move == pvMove)
+        {
+            rank = ORDER_PV;
+        }
+        else if (move == hashMove)
+        {
+            rank = ORDER_HASH;
+        }
+        else if (opponent & squareMask(to))
+        {
+            rank = lastDie ? ORDER_WINNING_CAPTURE : ORDER_CAPTURE;
+        }
+        else if (move == killers[ply][0])
+        {
+            rank = ORDER_KILLER + 1;
+        }
+        else if (move == killers[ply][1])
+        {
+            rank = ORDER_KILLER;
+        }
+        else
+        {
+            rank = history[player][move.from][to];
+        }
+        ordered[i] = (uint64_t)rank << 32 | move.pack();
+    }
+}
+
+Move Search::pickMove(uint64_t *ordered, int count, int i)
+{
+    if (i < SELECTION_PICKS)
+    {
+        int best = i;
+        for (int j = i + 1; j < count; j++)
+        {
+            if (ordered[j] > ordered[best])
+            {
+                best = j;
+            }
+        }
+        swap(ordered[i], ordered[best]);
+    }
+    else if (i == SELECTION_PICKS)
+    {
+        sort(ordered + i, ordered + count, greater<uint64_t>());
+    }
+    return Move::unpack(ordered[i] & 0xFFFFFFFF);
+}
+
+void Search::rememberCutoff(int player, int ply, int depth, Move move)
+{
+    if (!(killers[ply][0] == move))
+    {
+        killers[ply][1] = killers[ply][0];
+        killers[ply][0] = move;
+    }
+    int &count = history[player][move.from][move.getDestination()];
+    count += depth * depth;
+    if (count >= HISTORY_LIMIT)
+    {
+        for (int p = 0; p < 2; p++)
+        {
+            for (int from = 0; from < 64; from++)
+            {
+                for (int to = 0; to < 64; to++)
+                {
+                    history[p][from][to] /= 2;
+                }
+            }
+        }
+    }
+}
+
+int Search::evaluate(int player)
+{
+    STATS(chrono::steady_clock::time_point start = chrono::steady_clock::now());
+    int value = board.evaluate(player);
+    STATS(stats.evaluationNanos += (chrono::steady_clock::now() - start).count());
+    return value;
+}
+
+int Search::negamax(int player, int depth, int ply, int alpha, int beta)
+{
+    nodes++;
+    if (outOfTime())
+    {
+        return 0;
+    }
+    pvLength[ply] = 0;
+    int known;
+    if (ply > 0 && tablebase != nullptr && tablebase->probe(board, player, ply, &known))
+    {
+        return known;
+    }
+    if (depth == 0 || ply == MAX_PLY - 1)
+    {
+        return evaluate(player);
+    }
+
+    // Win scores are stored relative to the node so they stay valid wherever the position shows up.
+    uint64_t key = board.getHash() ^ ZOBRIST.side[player];
+    TableEntry entry;
+    Move hashMove;
+    STATS(stats.probes += table != nullptr);
+    if (table != nullptr && table->probe(key, &entry))
+    {
+        STATS(stats.hits++);
+        hashMove = entry.move;
+        int stored = entry.score;
+        if (stored > WIN_SCORE - MAX_PLY)
+        {
+            stored -= ply;
+        }
+        else if (stored < -WIN_SCORE + MAX_PLY)
+        {
+            stored += ply;
+        }
+        if (ply > 0 && entry.depth >= depth &&
+            (entry.bound == EXACT || (entry.bound == LOWER && stored >= beta) || (entry.bound == UPPER && stored <= alpha)))
+        {
+            return stored;
+        }
+    }
+
+    Move *moves = moveBuffers[ply];
+    STATS(chrono::steady_clock::time_point generationStart = chrono::steady_clock::now());
+    int count = board.getMoves(player, moves);
+    STATS(stats.generationNanos += (chrono::steady_clock::now() - generationStart).count(); stats.generations++;
+          stats.diceGenerated += board.nbDice(player); stats.movesGenerated += count);
+    if (count == 0)
+    {
+        return evaluate(player);
+    }
+    STATS(stats.expanded++);
+
+    // The previous iteration's line is tried first, it is the most likely to raise alpha.
+    Move pvMove;
+    if (followPV && ply < principalLength)
+    {
+        pvMove = principalVariation[ply];
+    }
+    uint64_t *ordered = orderBuffers[ply];
+    scoreMoves(player, ply, moves, count, pvMove, hashMove, ordered);
+
+    int alphaOrig = alpha;
+    Move best;
+    for (int i = 0; i < count; i++)
+    {
+        Move move = pickMove(ordered, count, i);
+        followPV = i == 0 && pvMove.length > 0 && move == pvMove;
+        board.makeMove(move);
+        int value;
+        if (board.nbDice(1 - player) == 0)
+        {
+            // Sooner wins score higher so the search goes for the shortest one.
+            value = WIN_SCORE - ply - 1;
+            pvLength[ply + 1] = 0;
+        }
+        else
+        {
+            value = -negamax(1 - player, depth - 1, ply + 1, -beta, -alpha);
+        }
+        board.unmakeMove();
+        if (stopped)
+        {
+            return 0;
+        }
+
+        if (value > alpha)
+        {
+            alpha = value;
+            best = move;
+            pv[ply][0] = move;
+            for (int j = 0; j < pvLength[ply + 1]; j++)
+            {
+                pv[ply][j + 1] = pv[ply + 1][j];
+            }
+            pvLength[ply] = pvLength[ply + 1] + 1;
+            if (alpha >= beta)
+            {
+                STATS(stats.cutoffs++);
+                if (!board.isCapture(move))
+                {
+                    rememberCutoff(player, ply, depth, move);
+                }
+                break;
+            }
+        }
+    }
+
+    int bound = alpha >= beta ? LOWER : (alpha > alphaOrig ? EXACT : UPPER);
+    int stored = alpha;
+    if (stored > WIN_SCORE - MAX_PLY)
+    {
+        stored += ply;
+    }
+    else if (stored < -WIN_SCORE + MAX_PLY)
+    {
+        stored -= ply;
+    }
+    if (table != nullptr)
+    {
+        table->store(key, best.length > 0 ? best : hashMove, stored, depth, bound);
+    }
+    return alpha;
+}
+
+// Exact negamax value of position to depth, ply is how deep position already is in a bigger tree.
+int Search::solve(Board position, int player, int depth, int ply)
+{
+    if (!ready)
+    {
+        arenaExhausted("the buffers of a search");
+    }
+    board = position;
+    principalLength = 0;
+    followPV = false;
+    stopped = false;
+    return negamax(player, depth, ply, -WIN_SCORE, WIN_SCORE);
+}
+
+Move Search::iterate(int player, int maxDepth)
+{
+    if (!ready)
+    {
+        arenaExhausted("the buffers of a search");
+    }
+    principalLength = 0;
+    stopped = false;
+    // Every other helper runs one ply ahead so the threads do not all walk the same tree in step.
+    for (int depth = 1 + helperIndex % 2; depth <= maxDepth && depth < MAX_PLY; depth++)
+    {
+        followPV = true;
+        int value = negamax(player, depth, 0, -WIN_SCORE, WIN_SCORE);
+        if (stopped)
+        {
+            // Only completed iterations are trusted.
+            break;
+        }
+        score = value;
+        principalLength = pvLength[0];
+        copy(pv[0], pv[0] + pvLength[0], principalVariation);
+        depthReached = depth;
+
+        // A forced win or loss was found, searching deeper cannot change it.
+        if (abs(score) >= WIN_SCORE - MAX_PLY)
+        {
+            break;
+        }
+    }
+    return principalLength == 0 ? Move() : principalVariation[0];
+}
+
+/**
+ * Lazy SMP: every thread runs its own Search on its own copy of the board, they only share the transposition table.
+ * Helpers fill the table for the main search, whose result is the one played, so one thread is the plain search.
+ */
+class ParallelSearch
+{
+private:
+    vector<Search *> searches;
+    atomic<bool> stopSignal;
+
+public:
+    ParallelSearch(Board board, TranspositionTable *table, Arena *arena, int threads);
+    void setDeadline(chrono::steady_clock::time_point deadline);
+    // Lets another thread abort the whole search, the helpers follow the main search.
+    void setStopSignal(atomic<bool> *stopSignal) { searches[0]->setStopSignal(stopSignal); };
+    void setTablebase(Tablebase *tablebase);
+    Move iterate(int player, int maxDepth);
+    Search *getMain() { return searches[0]; };
+    long getNodes();
+#ifdef DICE_STATS
+    SearchStats getStats();
+#endif
+};
+
+ParallelSearch::ParallelSearch(Board board, TranspositionTable *table, Arena *arena, int threads)
+{
+    stopSignal = false;
+    for (int i = 0; i < max(threads, 1); i++)
+    {
+        // Helpers which do not fit are left out, the search goes on with fewer threads.
+        Search *search = arena->create<Search>(board, table, arena);
+        if (search == nullptr || !search->isReady())
+        {
+            if (i == 0)
+            {
+                arenaExhausted("the main search");
+            }
+            cerr << "Arena full, searching with " << i << " threads" << endl;
+            break;
+        }
+        if (i > 0)
+        {
+            search->setHelper(i, &stopSignal);
+        }
+        searches.push_back(search);
+    }
+}
+
+void ParallelSearch::setDeadline(chrono::steady_clock::time_point deadline)
+{
+    for (Search *search : searches)
+    {
+        search->setDeadline(deadline);
+    }
+}
+
+Move ParallelSearch::iterate(int player, int maxDepth)
+{
+    stopSignal = false;
+    vector<thread> helpers;
+    for (size_t i = 1; i < searches.size(); i++)
+    {
+        helpers.emplace_back([this, i, player, maxDepth]()
+                             { searches[i]->iterate(player, maxDepth); });
+    }
+    Move best = searches[0]->iterate(player, maxDepth);
+    stopSignal = true;
+    for (thread &helper : helpers)
+    {
+        helper.join();
+    }
+    return best;
+}
+
+#ifdef DICE_STATS
+SearchStats ParallelSearch::getStats()
+{
+    SearchStats total;
+    for (Search *search : searches)
+    {
+        total.add(search->getStats());
+    }
+    return total;
+}
+#endif
+
+void ParallelSearch::setTablebase(Tablebase *tablebase)
+{
+    for (Search *search : searches)
+    {
+        search->setTablebase(tablebase);
+    }
+}
+
+long ParallelSearch::getNodes()
+{
+    long nodes = 0;
+    for (Search *search : searches)
+    {
+        nodes += search->getNodes();
+    }
+    return nodes;
+}
+
+/**
+ * A node of the Monte Carlo tree. Children are chained by index through nextSibling and added one at a time,
+ * in the order getMoves produces the moves, so a node only remembers how many it already expanded.
+ * wins is seen from the player who made move.
+ */
+struct MctsNode
+{
+    Move move;
+    int firstChild = -1;
+    int nextSibling = -1;
+    int visits = 0;
+    float wins = 0;
+    // -1 until the moves of the position were counted.
+    int16_t moveCount = -1;
+    int16_t expanded = 0;
+};
+
+/**
+ * Monte Carlo tree search with UCT selection and random playouts, an alternative to the alpha-beta search.
+ * Nodes come from a fixed pool in the turn's arena, when it is full the tree stops growing.
+ */
+class Mcts
+{
+private:
+    Board root;
+    int player = 0;
+    MctsNode *nodes;
+    int capacity;
+    int size = 0;
+    // Scratch index table used when re-rooting.
+    int *remap;
+    Move *moves;
+    bool ready;
+    uint64_t randomState;
+    long playouts = 0;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+    atomic<bool> *stopSignal = nullptr;
+    uint32_t random();
+    int select(int parent);
+    bool randomMove(Board &board, int toMove, Move *move);
+    float playout(Board &board, int toMove);
+
+public:
+    Mcts(Arena *arena, uint64_t seed);
+    void setRoot(Board board);
+    bool reroot(Board board, Move move);
+    void setDeadline(chrono::steady_clock::time_point deadline) { this->deadline = deadline; };
+    void setStopSignal(atomic<bool> *stopSignal) { this->stopSignal = stopSignal; };
+    Move run(int player);
+    long getPlayouts() { return playouts; };
+    int getSize() { return size; };
+    bool isReady() { return ready; };
+};
+
+Mcts::Mcts(Arena *arena, uint64_t seed)
+{
+    capacity = MCTS_NODES;
+    nodes = arena->allocateArray<MctsNode>(capacity);
+    remap = arena->allocateArray<int>(capacity);
+    moves = arena->allocateArray<Move>(MAX_MOVES);
+    ready = nodes != nullptr && remap != nullptr && moves != nullptr;
+    randomState = seed * 0x9E3779B97F4A7C15ULL | 1;
+}
+
+// Forgets the whole tree.
+void Mcts::setRoot(Board board)
+{
+    root = board;
+    size = 0;
+}
+
+/**
+ * Keeps the subtree reached by move, board is the position after it, and compacts it at the front of the pool.
+ * A child always has a larger index than its father, so walking the pool upwards numbers the subtree with
+ * indices which never pass the old ones and the copy can be done in place.
+ */
+bool Mcts::reroot(Board board, Move move)
+{
+    int node = size == 0 ? -1 : nodes[0].firstChild;
+    while (node != -1 && !(nodes[node].move == move))
+    {
+        node = nodes[node].nextSibling;
+    }
+    if (node == -1)
+    {
+        setRoot(board);
+        return false;
+    }
+
+    fill(remap + node, remap + size, -1);
+    remap[node] = 0;
+    int kept = 0;
+    for (int i = node; i < size; i++)
+    {
+        if (remap[i] == -1)
+        {
+            continue;
+        }
+        remap[i] = kept++;
+        for (int child = nodes[i].firstChild; child != -1; child = nodes[child].nextSibling)
+        {
+            remap[child] = 0;
+        }
+    }
+    for (int i = node; i < size; i++)
+    {
+        if (remap[i] == -1)
+        {
+            continue;
+        }
+        MctsNode copy = nodes[i];
+        copy.firstChild = copy.firstChild == -1 ? -1 : remap[copy.firstChild];
+        copy.nextSibling = copy.nextSibling == -1 || i == node ? -1 : remap[copy.nextSibling];
+        nodes[remap[i]] = copy;
+    }
+    size = kept;
+    root = board;
+    return true;
+}
+
+// xorshift64*, plenty for picking playout moves.
+uint32_t Mcts::random()
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return (randomState * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+int Mcts::select(int parent)
+{
+    float logVisits = log((float)nodes[parent].visits);
+    int best = -1;
+    float bestValue = -1;
+    for (int child = nodes[parent].firstChild; child != -1; child = nodes[child].nextSibling)
+    {
+        MctsNode &node = nodes[child];
+        float value = node.wins / node.visits + MCTS_EXPLORATION * sqrt(logVisits / node.visits);
+        if (value > bestValue)
+        {
+            bestValue = value;
+            best = child;
+        }
+    }
+    return best;
+}
+
+// Picks a random die which can move, then one of its moves at random.
+bool Mcts::randomMove(Board &board, int toMove, Move *move)
+{
+    int squares[8];
+    int count = 0;
+    for (uint64_t own = board.getOccupancy(toMove); own && count < 8; own &= own - 1)
+    {
+        squares[count++] = __builtin_ctzll(own);
+    }
+    int start = count == 0 ? 0 : random() % count;
+    for (int i = 0; i < count; i++)
+    {
+        int found = board.generateAllMoves(squares[(start + i) % count], moves);
+        if (found > 0)
+        {
+            *move = moves[random() % found];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Plays random moves and returns 1 when player wins, 0 when they lose, the dice count decides at the horizon.
+float Mcts::playout(Board &board, int toMove)
+{
+    for (int ply = 0; ply < MCTS_PLAYOUT_DEPTH && board.nbDice(toMove) > 0; ply++)
+    {
+        Move move;
+        if (!randomMove(board, toMove, &move))
+        {
+            break;
+        }
+        board.makeMove(move);
+        toMove = 1 - toMove;
+    }
+    int material = board.nbDice(player) - board.nbDice(1 - player);
+    return material > 0 ? 1 : (material < 0 ? 0 : 0.5);
+}
+
+Move Mcts::run(int player)
+{
+    if (!ready)
+    {
+        arenaExhausted("the Monte Carlo tree");
+    }
+    this->player = player;
+    playouts = 0;
+    if (size == 0)
+    {
+        size = 1;
+        nodes[0] = MctsNode();
+    }
+    do
+    {
+        Board board = root;
+        int path[MAX_PLY];
+        int length = 0;
+        int node = 0;
+        int toMove = player;
+        path[length++] = node;
+
+        // Walk down by UCT until a node still has untried moves, then add one of them.
+        while (length < MAX_PLY && board.nbDice(toMove) > 0)
+        {
+            MctsNode &current = nodes[node];
+            if (current.moveCount < 0)
+            {
+                current.moveCount = board.getMoves(toMove, moves);
+            }
+            if (current.moveCount == 0)
+            {
+                break;
+            }
+            if (current.expanded < current.moveCount)
+            {
+                if (size == capacity)
+                {
+                    break;
+                }
+                board.getMoves(toMove, moves);
+                int child = size++;
+                nodes[child] = MctsNode();
+                nodes[child].move = moves[current.expanded++];
+                nodes[child].nextSibling = current.firstChild;
+                current.firstChild = child;
+                board.makeMove(nodes[child].move);
+                toMove = 1 - toMove;
+                path[length++] = child;
+                break;
+            }
+            node = select(node);
+            board.makeMove(nodes[node].move);
+            toMove = 1 - toMove;
+            path[length++] = node;
+        }
+
+        float result = playout(board, toMove);
+        playouts++;
+        for (int i = 0; i < length; i++)
+        {
+            // Odd depths were reached by a move of player.
+            nodes[path[i]].visits++;
+            nodes[path[i]].wins += i % 2 == 1 ? result : 1 - result;
+        }
+    } while (chrono::steady_clock::now() < deadline && (stopSignal == nullptr || !stopSignal->load(memory_order_relaxed)));
+
+    int best = -1;
+    for (int child = nodes[0].firstChild; child != -1; child = nodes[child].nextSibling)
+    {
+        if (best == -1 || nodes[child].visits > nodes[best].visits)
+        {
+            best = child;
+        }
+    }
+    return best == -1 ? Move() : nodes[best].move;
+}
+
+/**
+ * Pondering: a background thread searches while we wait for the opponent's move.
+ * Its work goes to the structures shared with the real search, the transposition table or the Monte Carlo tree,
+ * so a hit on the predicted line finds it done and a miss only spent idle time.
+ */
+class Ponder
+{
+private:
+    thread worker;
+    atomic<bool> stopSignal;
+
+public:
+    Ponder() { stopSignal = false; };
+    // The worker runs at idle priority, and so do the threads it starts, so a turn never waits for the core.
+    template <typename Task>
+    void start(Task task)
+    {
+        worker = thread([task]()
+                        {
+            sched_param param = {};
+            pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+            task(); });
+    };
+    // Aborts the search and waits for it, the shared structures are then ours again.
+    void stop();
+    atomic<bool> *getStopSignal() { return &stopSignal; };
+};
+
+void Ponder::stop()
+{
+    if (worker.joinable())
+    {
+        stopSignal = true;
+        worker.join();
+    }
+    stopSignal = false;
+}
+
+struct BookEntry
+{
+    uint64_t key;
+    uint32_t move;
+    int16_t score;
+    uint8_t depth;
+    uint8_t unused;
+    bool operator<(const BookEntry &other) const { return key < other.key; };
+};
+
+/**
+ * Opening book: the best move found by a deep search for positions met on the first turns, sorted by key.
+ * A position and its 180 degree turn are the same game, so the key is the smaller of both hashes and the
+ * move is stored as seen in that orientation. The entries are read in place from the mapped file.
+ */
+class Book
+{
+private:
+    MappedFile file;
+    const BookEntry *entries = nullptr;
+    size_t count = 0;
+    static uint64_t canonicalKey(Board &board, bool *turned);
+
+public:
+    static bool build(string path, istream &layouts, int depth, int plies, int threads);
+    bool load(string path);
+    bool lookup(Board &board, int player, Move *move);
+    size_t size() { return count; };
+};
+
+uint64_t Book::canonicalKey(Board &board, bool *turned)
+{
+    uint64_t turnedHash = board.turned().getHash();
+    *turned = turnedHash < board.getHash();
+    return *turned ? turnedHash : board.getHash();
+}
+
+/**
+ * Plays every layout, one exported state per line, for plies plies with a search of the given depth on both sides,
+ * and keeps the positions where player 0 is to move. Layouts are shared between the threads.
+ */
+bool Book::build(string path, istream &layouts, int depth, int plies, int threads)
+{
+    vector<string> states;
+    string line;
+    while (getline(layouts, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        Board board;
+        if (!line.empty() && !board.parse(line.data(), line.size()))
+        {
+            cerr << "Invalid layout " << line << endl;
+            return false;
+        }
+        if (!line.empty())
+        {
+            states.push_back(line);
+        }
+    }
+
+    TranspositionTable table(TABLE_SIZE_LOG2);
+    vector<BookEntry> entries;
+    mutex entriesLock;
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int i = 0; i < max(threads, 1); i++)
+    {
+        workers.emplace_back([&]()
+                             {
+            Arena arena(ARENA_SIZE);
+            for (size_t layout = next++; layout < states.size(); layout = next++)
+            {
+                Board board;
+                board.parse(states[layout].data(), states[layout].size());
+                for (int ply = 0; ply < plies && board.isOver() == -1; ply++)
+                {
+                    int player = ply % 2;
+                    arena.reset();
+                    Search search(board, &table, &arena);
+                    Move best = search.iterate(player, depth);
+                    if (best.length == 0)
+                    {
+                        break;
+                    }
+                    if (player == 0)
+                    {
+                        bool turned;
+                        BookEntry entry;
+                        entry.key = canonicalKey(board, &turned);
+                        entry.move = (turned ? turn(best) : best).pack();
+                        entry.score = search.getScore();
+                        entry.depth = search.getDepth();
+                        entry.unused = 0;
+                        lock_guard<mutex> guard(entriesLock);
+                        entries.push_back(entry);
+                    }
+                    board.makeMove(best);
+                }
+            } });
+    }
+    for (thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    // A position reached from several layouts keeps its deepest search.
+    sort(entries.begin(), entries.end(), [](const BookEntry &a, const BookEntry &b)
+         { return a.key < b.key || (a.key == b.key && a.depth > b.depth); });
+    entries.erase(unique(entries.begin(), entries.end(), [](const BookEntry &a, const BookEntry &b)
+                         { return a.key == b.key; }),
+                  entries.end());
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        cerr << "Cannot write " << path << endl;
+        return false;
+    }
+    uint64_t count = entries.size();
+    bool written = fwrite(BOOK_MAGIC, 1, sizeof(BOOK_MAGIC), file) == sizeof(BOOK_MAGIC) &&
+                   fwrite(&count, sizeof(count), 1, file) == 1 &&
+                   fwrite(entries.data(), sizeof(BookEntry), count, file) == count;
+    fclose(file);
+    cout << count << " positions from " << states.size() << " layouts" << endl;
+    return written;
+}
+
+// The count in the header must match the size of the file, so a damaged book is refused rather than trusted.
+bool Book::load(string path)
+{
+    const size_t header = sizeof(BOOK_MAGIC) + sizeof(uint64_t);
+    if (!file.open(path) || file.getSize() < header || memcmp(file.getData(), BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0 ||
+        (file.getSize() - header) % sizeof(BookEntry) != 0)
+    {
+        return false;
+    }
+    uint64_t stored;
+    memcpy(&stored, file.getData() + sizeof(BOOK_MAGIC), sizeof(stored));
+    if (stored != (file.getSize() - header) / sizeof(BookEntry))
+    {
+        return false;
+    }
+    entries = (const BookEntry *)(file.getData() + header);
+    count = stored;
+    return true;
+}
+
+// Binary search on the key, the move is checked against the position in case of a hash collision.
+bool Book::lookup(Board &board, int player, Move *move)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+    bool turned;
+    BookEntry wanted;
+    wanted.key = canonicalKey(board, &turned);
+    const BookEntry *found = lower_bound(entries, entries + count, wanted);
+    if (found == entries + count || found->key != wanted.key)
+    {
+        return false;
+    }
+    Move stored = Move::unpack(found->move);
+    Move candidate = turned ? turn(stored) : stored;
+    if (!(board.getOccupancy(player) & squareMask(candidate.from)))
+    {
+        return false;
+    }
+    Move moves[MAX_DIE_MOVES];
+    int count = board.generateAllMoves(candidate.from, moves);
+    for (int i = 0; i < count; i++)
+    {
+        if (moves[i] == candidate)
+        {
+            *move = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * One side of a self-play game, either engine of the stdin loop with a table or tree of its own.
+ */
+class Engine
+{
+private:
+    bool monteCarlo;
+    TranspositionTable table;
+    Arena *arena;
+    unique_ptr<Arena> treeArena;
+    Mcts *mcts = nullptr;
+
+public:
+    Engine(string kind, Arena *arena, uint64_t seed);
+    Move play(Board board, int player, chrono::steady_clock::time_point deadline, long *nodes);
+};
+
+Engine::Engine(string kind, Arena *arena, uint64_t seed) : table(SELF_PLAY_TABLE_SIZE_LOG2)
+{
+    monteCarlo = kind == "mcts";
+    this->arena = arena;
+    if (monteCarlo)
+    {
+        treeArena.reset(new Arena(MCTS_ARENA_SIZE));
+        mcts = treeArena->create<Mcts>(treeArena.get(), seed);
+        if (mcts == nullptr || !mcts->isReady())
+        {
+            arenaExhausted("the Monte Carlo tree");
+        }
+    }
+}
+
+// nodes counts playouts for the Monte Carlo engine.
+Move Engine::play(Board board, int player, chrono::steady_clock::time_point deadline, long *nodes)
+{
+    arena->reset();
+    if (monteCarlo)
+    {
+        mcts->setRoot(board);
+        mcts->setDeadline(deadline);
+        Move best = mcts->run(player);
+        *nodes += mcts->getPlayouts();
+        return best;
+    }
+    Search search(board, &table, arena);
+    search.setDeadline(deadline);
+    Move best = search.iterate(player, MAX_PLY - 1);
+    *nodes += search.getNodes();
+    return best;
+}
+
+/**
+ * Headless self-play between two engines. Game 2k and 2k + 1 start from the same seeded layout with the
+ * engines swapping sides, games run in parallel and only the totals are shared.
+ */
+class SelfPlay
+{
+private:
+    string engines[2];
+    int moveTimeMs;
+    uint64_t seed;
+    mutex resultsLock;
+    // Wins, draws and losses of engines[0].
+    int results[3] = {0, 0, 0};
+    vector<double> latencies[2];
+    long nodes[2] = {0, 0};
+    double thinking[2] = {0, 0};
+    void playGame(int game, Arena *arena);
+
+public:
+    SelfPlay(string first, string second, int moveTimeMs, uint64_t seed);
+    void run(int games, int threads);
+    void report();
+};
+
+SelfPlay::SelfPlay(string first, string second, int moveTimeMs, uint64_t seed)
+{
+    engines[0] = first;
+    engines[1] = second;
+    this->moveTimeMs = moveTimeMs;
+    this->seed = seed;
+}
+
+void SelfPlay::playGame(int game, Arena *arena)
+{
+    // Player 0 on the top row and player 1 on the bottom one, every die turned at random.
+    mt19937_64 random(seed + game / 2);
+    Board board;
+    for (int column = 0; column < 8; column++)
+    {
+        board.addDice(column, 0, Die(random() % 24));
+        board.addDice(56 + column, 1, Die(random() % 24));
+    }
+    // sides[player] is the index of the engine playing it.
+    int sides[2] = {game % 2, 1 - game % 2};
+    unique_ptr<Engine> players[2];
+    for (int player = 0; player < 2; player++)
+    {
+        players[player].reset(new Engine(engines[sides[player]], arena, seed * 2 + game * 2 + player));
+    }
+
+    vector<double> gameLatencies[2];
+    long gameNodes[2] = {0, 0};
+    for (int ply = 0; ply < SELF_PLAY_MAX_PLIES && board.isOver() == -1; ply++)
+    {
+        int player = ply % 2;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Move move = players[player]->play(board, player, start + chrono::milliseconds(moveTimeMs), &gameNodes[sides[player]]);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        gameLatencies[sides[player]].push_back(chrono::duration<double, milli>(end - start).count());
+        if (move.length == 0)
+        {
+            break;
+        }
+        board.makeMove(move);
+    }
+
+    // Games without a capture of the last die are decided on the dice left.
+    int score = board.getScore();
+    int outcome = score == 0 ? 1 : ((score > 0) == (sides[0] == 0) ? 0 : 2);
+    lock_guard<mutex> guard(resultsLock);
+    results[outcome]++;
+    for (int engine = 0; engine < 2; engine++)
+    {
+        latencies[engine].insert(latencies[engine].end(), gameLatencies[engine].begin(), gameLatencies[engine].end());
+        nodes[engine] += gameNodes[engine];
+        for (double latency : gameLatencies[engine])
+        {
+            thinking[engine] += latency / 1000;
+        }
+    }
+}
+
+void SelfPlay::run(int games, int threads)
+{
+    atomic<int> next(0);
+    vector<thread> workers;
+    for (int i = 0; i < max(threads, 1); i++)
+    {
+        workers.emplace_back([this, games, &next]()
+                             {
+            Arena arena(ARENA_SIZE);
+            for (int game = next++; game < games; game = next++)
+            {
+                playGame(game, &arena);
+            } });
+    }
+    for (thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// The score of the first engine comes with a 95% confidence interval from the normal approximation.
+void SelfPlay::report()
+{
+    int games = results[0] + results[1] + results[2];
+    if (games == 0)
+    {
+        return;
+    }
+    // Wilson interval at 95%, unlike the normal approximation it stays meaningful for a score near 0 or 100%.
+    double score = (results[0] + results[1] / 2.0) / games;
+    double z = 1.96;
+    double spread = z * z / games;
+    double center = (score + spread / 2) / (1 + spread);
+    double margin = z * sqrt(score * (1 - score) / games + spread / (4 * games)) / (1 + spread);
+    cout << engines[0] << " against " << engines[1] << ": " << results[0] << " wins, " << results[1] << " draws, "
+         << results[2] << " losses in " << games << " games" << endl;
+    cout << "Score " << 100 * score << "%, 95% interval " << 100 * (center - margin) << "% to " << 100 * (center + margin)
+         << "%" << endl;
+    for (int engine = 0; engine < 2; engine++)
+    {
+        vector<double> &sorted = latencies[engine];
+        if (sorted.empty())
+        {
+            continue;
+        }
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](double q)
+        { return sorted[min(sorted.size() - 1, (size_t)(q * sorted.size()))]; };
+        cout << engines[engine] << ": " << (long)(nodes[engine] / max(thinking[engine], 1e-9)) << " nodes/s, move latency p50 "
+             << percentile(0.5) << " ms, p90 " << percentile(0.9) << " ms, p99 " << percentile(0.99) << " ms, max "
+             << sorted.back() << " ms" << endl;
+    }
+}
+
+/**
+ * Perft: counts the leaves of the move tree to a fixed depth, a finished game is a leaf and a player without
+ * any move adds nothing. Checks the move generator against known counts and measures its speed.
+ */
+class Perft
+{
+private:
+    Board board;
+    Move *moveBuffers[MAX_PLY];
+    long count(int player, int depth, int ply);
+
+public:
+    Perft(Board board, int depth, Arena *arena);
+    long run(int player, int depth, bool divide);
+};
+
+Perft::Perft(Board board, int depth, Arena *arena)
+{
+    this->board = board;
+    for (int ply = 0; ply < depth && ply < MAX_PLY; ply++)
+    {
+        moveBuffers[ply] = arena->allocateArray<Move>(MAX_MOVES);
+        if (moveBuffers[ply] == nullptr)
+        {
+            arenaExhausted("the buffers of perft");
+        }
+    }
+}
+
+long Perft::count(int player, int depth, int ply)
+{
+    if (depth == 0 || board.isOver() != -1)
+    {
+        return 1;
+    }
+    Move *moves = moveBuffers[ply];
+    int found = board.getMoves(player, moves);
+    // The last ply only needs the number of moves.
+    if (depth == 1)
+    {
+        return found;
+    }
+    long leaves = 0;
+    for (int i = 0; i < found; i++)
+    {
+        board.makeMove(moves[i]);
+        leaves += count(1 - player, depth - 1, ply + 1);
+        board.unmakeMove();
+    }
+    return leaves;
+}
+
+// With divide, the count below every root move is printed too.
+long Perft::run(int player, int depth, bool divide)
+{
+    if (!divide || depth == 0 || board.isOver() != -1)
+    {
+        return count(player, depth, 0);
+    }
+    Move *moves = moveBuffers[0];
+    int found = board.getMoves(player, moves);
+    long leaves = 0;
+    for (int i = 0; i < found; i++)
+    {
+        board.makeMove(moves[i]);
+        long below = count(1 - player, depth - 1, 1);
+        board.unmakeMove();
+        cout << toString(moves[i]) << ": " << below << endl;
+        leaves += below;
+    }
+    return leaves;
+}
+
+struct BatchResult
+{
+    Move move;
+    int score = 0;
+    bool valid = false;
+};
+
+/**
+ * Scores many exported states at once, player 0 to move, with a search of the given depth or the static
+ * evaluation when depth is 0. Lines point into the input buffer, workers take them in chunks and write each
+ * result to the slot of its line so the output keeps the input order.
+ */
+class Batch
+{
+private:
+    vector<pair<const char *, size_t>> lines;
+    vector<BatchResult> results;
+    int depth;
+    void score(size_t line, Arena *arena);
+
+public:
+    Batch(const char *input, size_t size, int depth);
+    void run(int threads);
+    string format();
+};
+
+Batch::Batch(const char *input, size_t size, int depth)
+{
+    this->depth = depth;
+    const char *end = input + size;
+    for (const char *start = input; start < end;)
+    {
+        const char *newline = (const char *)memchr(start, '\n', end - start);
+        const char *stop = newline == nullptr ? end : newline;
+        size_t length = stop - start;
+        if (length > 0 && start[length - 1] == '\r')
+        {
+            length--;
+        }
+        if (length > 0)
+        {
+            lines.push_back({start, length});
+        }
+        start = stop + 1;
+    }
+    results.resize(lines.size());
+}
+
+// Searches run without a transposition table so a line's result does not depend on what its worker did before.
+void Batch::score(size_t line, Arena *arena)
+{
+    Board board;
+    BatchResult &result = results[line];
+    result.valid = board.parse(lines[line].first, lines[line].second);
+    if (!result.valid)
     {
-        neighbours[RIGHT] = 2;
+        return;
     }
-    else if (board.find(position + 1) != board.end())
+    if (depth == 0)
     {
-        neighbours[RIGHT] = board.at(position + 1)->getOwner();
+        result.score = board.evaluate(0);
+        return;
     }
+    arena->reset();
+    Search search(board, nullptr, arena);
+    result.move = search.iterate(0, depth);
+    result.score = search.getScore();
+}
 
-    if (position % 8 == 0)
+void Batch::run(int threads)
+{
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int i = 0; i < max(threads, 1); i++)
     {
-        neighbours[LEFT] = 2;
+        workers.emplace_back([this, &next]()
+                             {
+            Arena arena(ARENA_SIZE);
+            for (size_t chunk = next.fetch_add(BATCH_CHUNK); chunk < lines.size(); chunk = next.fetch_add(BATCH_CHUNK))
+            {
+                for (size_t line = chunk; line < min(chunk + BATCH_CHUNK, lines.size()); line++)
+                {
+                    score(line, &arena);
+                }
+            } });
     }
-    else if (board.find(position - 1) != board.end())
+    for (thread &worker : workers)
     {
-        neighbours[LEFT] = board.at(position - 1)->getOwner();
+        worker.join();
     }
 }
 
-void Board::generateAllMoves(Die *d, int length, MoveTree *tree, vector<string> *moves)
+// One line per input line: the score, after the best move when searching, or invalid.
+string Batch::format()
 {
-    if (length == 0)
-    {
-        moves->push_back(tree->getCurrent());
-        set<int> v = tree->getVisited();
-        return;
-    }
-    int neighbours[4] = {-1, -1, -1, -1};
-    int player = d->getOwner();
-    getNeighbours(tree->getPosition(), neighbours);
-    for (int dir = 0; dir < 4; dir++)
+    string output;
+    output.reserve(results.size() * 16);
+    for (BatchResult &result : results)
     {
-        if (neighbours[dir] == -1)
+        if (!result.valid)
         {
-            tree->addSon(dir);
+            output += "invalid\n";
+            continue;
         }
-        else if (length == 1)
+        if (depth > 0)
         {
-            if (neighbours[dir] != 2 and neighbours[dir] != player)
-            {
-                tree->addSon(dir);
-            }
+            output += (result.move.length > 0 ? toString(result.move) : string("none")) + " ";
         }
+        output += to_string(result.score) + "\n";
     }
+    return output;
+}
 
-    for (auto it : tree->getSons())
-    {
-        generateAllMoves(d, length - 1, it.second, moves);
-    }
+/**
+ * Exhaustive analysis of a position: the first plies are expanded into a StrategyTree, and the exact value of the
+ * subtree under each of its leaves is computed by a pool of workers. Each worker pops tasks from the back of its
+ * own queue and steals from the front of the others' when it runs dry.
+ * Scores in the tree are seen from the player who made the move leading to the node.
+ */
+class Analysis
+{
+private:
+    Board root;
+    int player;
+    int depth;
+    int threads;
+    Arena *arena;
+    // The worker searches get their own arena, sized for the threads, so the tree cannot crowd them out.
+    unique_ptr<Arena> searchArena;
+    StrategyTree *tree = nullptr;
+    vector<deque<StrategyTree *>> queues;
+    unique_ptr<mutex[]> locks;
+    int pushed = 0;
+    void expand(int player, StrategyTree *node, int ply, int splitDepth);
+    bool nextTask(int worker, StrategyTree **task);
+    void work(int worker, Search *search);
+
+public:
+    Analysis(Board board, int player, Arena *arena, int threads);
+    StrategyTree *run(int depth);
+};
+
+Analysis::Analysis(Board board, int player, Arena *arena, int threads)
+{
+    this->root = board;
+    this->player = player;
+    this->arena = arena;
+    this->threads = max(threads, 1);
 }
 
-void Board::getMoves(int player, map<int, vector<string>> *allMoves)
+void Analysis::expand(int player, StrategyTree *node, int ply, int splitDepth)
 {
-    map<int, Die *> iter;
-    if (player == 0)
+    if (ply == splitDepth)
     {
-        iter = me->getDice();
+        // Spread the subtrees over the workers, the stealing evens out their sizes.
+        queues[pushed++ % threads].push_back(node);
+        return;
     }
-    else
+    Move moves[MAX_MOVES];
+    int count = root.getMoves(player, moves);
+    if (count == 0)
     {
-        iter = adv->getDice();
+        node->setScore(-root.evaluate(player));
+        return;
     }
-    for (auto it : iter)
+    for (int i = 0; i < count; i++)
     {
-        Die *d = it.second;
-        int length = d->getFaceup();
-        // cout << "Starting tree for dice at " << to_string(d->getPosition()) << endl;
-        MoveTree *tree = new MoveTree(toString(d->getPosition()) + " ", d->getPosition());
-        vector<string> moves;
-        generateAllMoves(d, length, tree, &moves);
-        allMoves->insert({d->getPosition(), moves});
+        StrategyTree *son = node->addSon(moves[i]);
+        if (son == nullptr)
+        {
+            arenaExhausted("the analysis tree");
+        }
+        root.makeMove(moves[i]);
+        if (root.nbDice(1 - player) == 0)
+        {
+            son->setScore(WIN_SCORE - ply - 1);
+        }
+        else
+        {
+            expand(1 - player, son, ply + 1, splitDepth);
+        }
+        root.unmakeMove();
     }
 }
 
-void Board::populate()
+bool Analysis::nextTask(int worker, StrategyTree **task)
 {
-    Die *d;
-    d = new Die(32, 0, 4, 3, 1);
-    this->addDice(d);
-    d = new Die(56, 1, 4, 2, 1);
-    this->addDice(d);
-    d = new Die(57, 1, 6, 3, 2);
-    this->addDice(d);
+    for (int i = 0; i < threads; i++)
+    {
+        int victim = (worker + i) % threads;
+        lock_guard<mutex> guard(locks[victim]);
+        if (queues[victim].empty())
+        {
+            continue;
+        }
+        if (victim == worker)
+        {
+            *task = queues[victim].back();
+            queues[victim].pop_back();
+        }
+        else
+        {
+            *task = queues[victim].front();
+            queues[victim].pop_front();
+        }
+        return true;
+    }
+    return false;
 }
 
-int Board::toNumber(string position)
-{
-    return position.at(0) - 65 + 56 - 8 * (position.at(1) - 49);
-};
-
-void Board::showBoard()
+void Analysis::work(int worker, Search *search)
 {
-    string res = "  |A B C D E F G H\n";
-    res += "--+---------------\n";
-    for (int i = 0; i < 8; i++)
+    StrategyTree *task;
+    while (nextTask(worker, &task))
     {
-        res += 56 - i;
-        res += " |";
-        for (int j = 0; j < 8; j++)
+        // Replay the moves from the root, the tree only keeps the last one of each node.
+        Move path[MAX_PLY];
+        int length = 0;
+        for (StrategyTree *node = task; node->getFather() != nullptr; node = node->getFather())
         {
-            if (this->board.find(i * 8 + j) != this->board.end())
-            {
-                Die *d = this->board[i * 8 + j];
-                res += to_string(d->getFaceup());
-                res += " ";
-            }
-            else
-            {
-                res += "  ";
-            }
+            path[length++] = node->getMove();
         }
-        res += "\n";
+        Board board = root;
+        for (int i = length - 1; i >= 0; i--)
+        {
+            board.makeMove(path[i]);
+        }
+        int toMove = length % 2 == 0 ? player : 1 - player;
+        task->setScore(-search->solve(board, toMove, depth - length, length));
     }
-    cout << res << endl;
 }
 
-string Board::toString(int position)
+StrategyTree *Analysis::run(int depth)
 {
-    string pos = "__";
-    pos[1] = 56 - position / 8;
-    pos[0] = position % 8 + 65;
-    return pos;
+    this->depth = depth;
+    int splitDepth = min(depth, ANALYSIS_SPLIT_DEPTH);
+    queues.assign(threads, deque<StrategyTree *>());
+    locks.reset(new mutex[threads]);
+    pushed = 0;
+    tree = arena->create<StrategyTree>(nullptr, arena);
+    if (tree == nullptr)
+    {
+        arenaExhausted("the analysis tree");
+    }
+    expand(player, tree, 0, splitDepth);
+
+    // The searches and their buffers are allocated before the workers start.
+    searchArena.reset(new Arena(threads * Search::getArenaBytes()));
+    vector<Search *> searches;
+    for (int i = 0; i < threads; i++)
+    {
+        Search *search = searchArena->create<Search>(root, nullptr, searchArena.get());
+        if (search == nullptr || !search->isReady())
+        {
+            arenaExhausted("the analysis searches");
+        }
+        searches.push_back(search);
+    }
+    vector<thread> workers;
+    for (int i = 1; i < threads; i++)
+    {
+        workers.emplace_back([this, i, &searches]()
+                             { work(i, searches[i]); });
+    }
+    work(0, searches[0]);
+    for (thread &worker : workers)
+    {
+        worker.join();
+    }
+    tree->backUp();
+    return tree;
 }
 
 void Board::testGrid()
@@ -780,49 +3266,48 @@ void Board::testGrid()
     showBoard();
 
     cout << "\nTesting rotation..." << endl;
-    Die *d = this->board[32];
     cout << "\nMoving DOWN" << endl;
-    rotation(d, DOWN);
+    rotation(32, DOWN, nullptr);
     showBoard();
     cout << "\nMoving RIGHT" << endl;
-    rotation(d, RIGHT);
+    rotation(40, RIGHT, nullptr);
     showBoard();
     cout << "\nMoving LEFT" << endl;
-    rotation(d, LEFT);
+    rotation(41, LEFT, nullptr);
     showBoard();
     cout << "\nMoving UP" << endl;
-    rotation(d, UP);
+    rotation(40, UP, nullptr);
     showBoard();
 
     cout << "\nTesting Players..." << endl;
     cout << "My dice" << endl;
-    me->showDice();
+    showDice(0);
     cout << "Adv's dice" << endl;
-    adv->showDice();
+    showDice(1);
     cout << "Eating adv's dice" << endl;
-    d = this->board[32];
-    string move = toString(d->getPosition()) + " DDRD";
-    cout << "Doing move " << move << endl;
-    Die *eaten = simulateMove(move);
-    cout << "Die " << toString(eaten->getPosition()) << " of " << eaten->getOwner() << " was eaten." << endl;
+    Move move = toMove(toString(32) + " DDRD");
+    cout << "Doing move " << toString(move) << endl;
+    makeMove(move);
+    cout << "Die " << toString(move.getDestination()) << " of " << 1 << " was eaten." << endl;
     showBoard();
-    adv->showDice();
+    showDice(1);
 
     cout << "\nTesting reverting" << endl;
-    revertMove(move, toString(d->getPosition()), eaten);
+    unmakeMove();
     showBoard();
-    adv->showDice();
+    showDice(1);
 
     cout << "\nTesting Tree..." << endl;
     cout << "Current board export is:" << endl;
     cout << exportState() << endl;
-    StrategyTree *tree = new StrategyTree(nullptr);
+    Arena arena(ARENA_SIZE);
+    StrategyTree *tree = arena.create<StrategyTree>(nullptr, &arena);
     buildTree(0, tree, 2);
     cout << tree->prettyPrint(0);
 
     cout << "\nTesting best move..." << endl;
     StrategyTree *best = tree->getBest();
-    cout << "Best was " << best->getMoves().back() << " with " << best->getScore() << endl;
+    cout << "Best was " << toString(best->getMove()) << " with " << best->getScore() << endl;
 }
 
 void Board::testManyTurns()
@@ -830,37 +3315,32 @@ void Board::testManyTurns()
 
     srand(time(0));
 
-    Die *d;
     for (int i = 0; i < 8; i++)
     {
-        d = new Die(i, 0, rand() % 6 + 1, rand() % 6 + 1, rand() % 6 + 1);
-        this->addDice(d);
+        this->addDice(i, 0, Die(rand() % 24));
     }
 
     for (int i = 0; i < 8; i++)
     {
-        d = new Die(63 - i, 1, rand() % 6 + 1, rand() % 6 + 1, rand() % 6 + 1);
-        this->addDice(d);
+        this->addDice(63 - i, 1, Die(rand() % 24));
     }
     showBoard();
     int player = 0;
+    TranspositionTable table(TABLE_SIZE_LOG2);
+    Arena arena(ARENA_SIZE);
     chrono::_V2::steady_clock::time_point start;
     chrono::_V2::steady_clock::time_point end;
 
-    while (me->nbDice() != 0 && adv->nbDice() != 0)
+    while (nbDice(0) != 0 && nbDice(1) != 0)
     {
         cout << "\nP" << to_string(player) << " plays" << endl;
         start = chrono::steady_clock::now();
 
-        StrategyTree *tree = new StrategyTree(nullptr);
-
-        buildTree(player, tree, 2);
-        tree = tree->getBest();
-        simulateMove(tree->getMoves().back());
+        arena.reset();
+        Search search(*this, &table, &arena);
+        makeMove(search.iterate(player, SEARCH_DEPTH));
         end = chrono::steady_clock::now();
 
-        // cout << tree->prettyPrint(0) << endl;
-
         cout << "Elapsed time in milliseconds: "
              << chrono::duration_cast<chrono::milliseconds>(end - start).count()
              << " ms" << endl;
@@ -870,50 +3350,518 @@ void Board::testManyTurns()
         showBoard();
         sleep(1);
     }
-    cout << "Finished! P0: " << me->nbDice() << ", P1: " << adv->nbDice() << "..." << endl;
+    cout << "Finished! P0: " << nbDice(0) << ", P1: " << nbDice(1) << "..." << endl;
+}
+
+/**
+ * The referee's protocol without iostreams or the heap: input is read from the file descriptor in large blocks
+ * into a fixed buffer and parsed in place, usually one read per turn, and each answer leaves in a single write.
+ */
+class TurnIO
+{
+private:
+    char buffer[TURN_BUFFER_SIZE];
+    size_t start = 0;
+    size_t end = 0;
+    int input;
+    int output;
+    bool peek(char *c);
+    bool readInt(int *value);
+    bool readCell(int *position);
+
+public:
+    TurnIO(int input, int output);
+    bool readCount(int *count);
+    bool readDice(Board *board, int count);
+    void writeMove(Move move);
+};
+
+TurnIO::TurnIO(int input, int output)
+{
+    this->input = input;
+    this->output = output;
+}
+
+// Looks at the next character, reading more input when the buffer is used up. False at the end of the input.
+bool TurnIO::peek(char *c)
+{
+    if (start == end)
+    {
+        ssize_t got = read(input, buffer, sizeof(buffer));
+        if (got <= 0)
+        {
+            return false;
+        }
+        start = 0;
+        end = got;
+    }
+    *c = buffer[start];
+    return true;
+}
+
+bool TurnIO::readInt(int *value)
+{
+    char c;
+    while (peek(&c) && isspace((unsigned char)c))
+    {
+        start++;
+    }
+    if (!peek(&c) || !isdigit((unsigned char)c))
+    {
+        return false;
+    }
+    *value = 0;
+    while (peek(&c) && isdigit((unsigned char)c))
+    {
+        *value = *value * 10 + c - '0';
+        start++;
+    }
+    return true;
+}
+
+// A cell like A8, column letter then row digit.
+bool TurnIO::readCell(int *position)
+{
+    char c;
+    while (peek(&c) && isspace((unsigned char)c))
+    {
+        start++;
+    }
+    char cell[2];
+    for (int i = 0; i < 2; i++)
+    {
+        if (!peek(&cell[i]))
+        {
+            return false;
+        }
+        start++;
+    }
+    if (cell[0] < 'A' || cell[0] > 'H' || cell[1] < '1' || cell[1] > '8')
+    {
+        return false;
+    }
+    *position = cell[0] - 'A' + 56 - 8 * (cell[1] - '1');
+    return true;
 }
 
-int main()
+bool TurnIO::readCount(int *count)
 {
+    return readInt(count);
+}
+
+// Each die is: owner cell top front bottom back left right.
+bool TurnIO::readDice(Board *board, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int owner;
+        int position;
+        int faces[6];
+        if (!readInt(&owner) || !readCell(&position))
+        {
+            return false;
+        }
+        for (int &face : faces)
+        {
+            if (!readInt(&face))
+            {
+                return false;
+            }
+        }
+        // Bottom, back and left follow from the other three.
+        board->addDice(position, owner, Die(faces[0], faces[1], faces[5]));
+    }
+    return true;
+}
+
+void TurnIO::writeMove(Move move)
+{
+    char line[16];
+    int length = 0;
+    line[length++] = 'A' + move.from % 8;
+    line[length++] = '8' - move.from / 8;
+    line[length++] = ' ';
+    for (int i = 0; i < move.length; i++)
+    {
+        line[length++] = toChar(move.getDirection(i));
+    }
+    line[length++] = '\n';
+    if (write(output, line, length) != length)
+    {
+        cerr << "Cannot write the move" << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // --threads N searches with N threads, the referee's machine only gives us one. The offline modes use every
+    // core unless --threads says otherwise.
+    // --engine mcts plays with the Monte Carlo tree search instead of alpha-beta.
+    // --ponder keeps searching while the opponent thinks.
+    // --tablebase FILE plays the one die against one endings from a file written by the tablebase mode.
+    // --book FILE plays the first turns from an opening book written by the book mode.
+    int threads = 1;
+    bool threadsGiven = false;
+    string engine = "alphabeta";
+    bool pondering = false;
+    Tablebase tablebase;
+    Book book;
+    vector<string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--threads" && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            threadsGiven = true;
+            if (threads < 1 || threads > MAX_THREADS)
+            {
+                cerr << "--threads takes a count between 1 and " << MAX_THREADS << endl;
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--engine" && i + 1 < argc)
+        {
+            engine = argv[++i];
+            if (engine != "alphabeta" && engine != "mcts")
+            {
+                cerr << "--engine takes alphabeta or mcts" << endl;
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--ponder")
+        {
+            pondering = true;
+        }
+        else if (string(argv[i]) == "--tablebase" && i + 1 < argc)
+        {
+            string path = argv[++i];
+            if (!tablebase.open(path))
+            {
+                cerr << "Cannot load the tablebase " << path << endl;
+            }
+        }
+        else if (string(argv[i]) == "--book" && i + 1 < argc)
+        {
+            string path = argv[++i];
+            if (!book.load(path))
+            {
+                cerr << "Cannot load the book " << path << endl;
+            }
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    int offlineThreads = threadsGiven ? threads : clamp((int)thread::hardware_concurrency(), 1, MAX_THREADS);
+
+    // analyze <exported state> <depth>: exact values of every move and reply, player 0 to move.
+    if (args.size() == 3 && args[0] == "analyze")
+    {
+        Board board;
+        if (!board.parse(args[1].data(), args[1].size()))
+        {
+            cerr << "Invalid state " << args[1] << endl;
+            return 1;
+        }
+        Arena arena(ARENA_SIZE);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Analysis analysis(board, 0, &arena, offlineThreads);
+        StrategyTree *tree = analysis.run(stoi(args[2]));
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        cout << tree->prettyPrint(0) << endl;
+        StrategyTree *best = tree->getBest();
+        if (best != nullptr)
+        {
+            cout << "Best was " << toString(best->getMove()) << " with " << best->getScore() << endl;
+        }
+        cout << "Analyzed in " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms" << endl;
+        return 0;
+    }
+
+    // tablebase <file>: solves every one die against one position and writes them to file.
+    if (args.size() == 2 && args[0] == "tablebase")
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool written = Tablebase::generate(args[1]);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        cout << "Generated in " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms" << endl;
+        return written ? 0 : 1;
+    }
+
+    // book <file> <depth> <plies>: plays the layouts read on stdin, one exported state per line, and writes the book.
+    if (args.size() == 4 && args[0] == "book")
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool written = Book::build(args[1], cin, stoi(args[2]), stoi(args[3]), offlineThreads);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        cout << "Built in " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms" << endl;
+        return written ? 0 : 1;
+    }
+
+    // selfplay <games> <engine> <engine> [move ms] [seed]: engines are alphabeta or mcts, games run on one worker per core or --threads.
+    if (args.size() >= 4 && args.size() <= 6 && args[0] == "selfplay")
+    {
+        int moveTimeMs = args.size() > 4 ? stoi(args[4]) : TURN_BUDGET_MS;
+        uint64_t seed = args.size() > 5 ? stoull(args[5]) : 1;
+        for (int i = 2; i <= 3; i++)
+        {
+            if (args[i] != "alphabeta" && args[i] != "mcts")
+            {
+                cerr << "Unknown engine " << args[i] << ", engines are alphabeta or mcts" << endl;
+                return 1;
+            }
+        }
+        SelfPlay selfPlay(args[2], args[3], moveTimeMs, seed);
+        selfPlay.run(stoi(args[1]), offlineThreads);
+        selfPlay.report();
+        return 0;
+    }
+
+    // perft <state> <depth> [divide]: leaves of the move tree with player 0 to move.
+    // perft suite: checks the reference counts, fails when one differs.
+    if ((args.size() == 2 || args.size() == 3 || args.size() == 4) && args[0] == "perft")
+    {
+        Arena arena(ARENA_SIZE);
+        if (args.size() == 2 && args[1] == "suite")
+        {
+            bool passed = true;
+            long leaves = 0;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (const PerftCase &test : PERFT_SUITE)
+            {
+                arena.reset();
+                Board board;
+                board.parse(test.state, strlen(test.state));
+                Perft perft(board, test.depth, &arena);
+                long found = perft.run(0, test.depth, false);
+                leaves += found;
+                passed = passed && found == test.leaves;
+                cout << (found == test.leaves ? "ok   " : "FAIL ") << test.state << " depth " << test.depth << ": " << found
+                     << (found == test.leaves ? "" : " expected " + to_string(test.leaves)) << endl;
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << leaves << " leaves in " << seconds << " s, " << (long)(leaves / seconds) << " leaves/s" << endl;
+            return passed ? 0 : 1;
+        }
+        if (args.size() >= 3)
+        {
+            Board board;
+            if (!board.parse(args[1].data(), args[1].size()))
+            {
+                cerr << "Invalid state " << args[1] << endl;
+                return 1;
+            }
+            int depth = stoi(args[2]);
+            Perft perft(board, depth, &arena);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            long leaves = perft.run(0, depth, args.size() == 4 && args[3] == "divide");
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << leaves << " leaves in " << seconds << " s, " << (long)(leaves / seconds) << " leaves/s" << endl;
+            return 0;
+        }
+    }
+
+    // batch <depth>|eval: scores the exported states read on stdin, one per line, on one worker per core or --threads.
+    if (args.size() == 2 && args[0] == "batch")
+    {
+        int depth = args[1] == "eval" ? 0 : stoi(args[1]);
+        vector<char> input;
+        char chunk[1 << 16];
+        bool done = false;
+        while (!done)
+        {
+            size_t read = fread(chunk, 1, sizeof(chunk), stdin);
+            done = read == 0;
+            input.insert(input.end(), chunk, chunk + read);
+            if (!done && input.size() < BATCH_BLOCK)
+            {
+                continue;
+            }
+            // A block ends after its last complete line, the rest waits for the next one.
+            size_t length = input.size();
+            if (!done)
+            {
+                const char *last = (const char *)memrchr(input.data(), '\n', input.size());
+                if (last == nullptr)
+                {
+                    continue;
+                }
+                length = last - input.data() + 1;
+            }
+            Batch batch(input.data(), length, depth);
+            batch.run(offlineThreads);
+            string output = batch.format();
+            fwrite(output.data(), 1, output.size(), stdout);
+            input.erase(input.begin(), input.begin() + length);
+        }
+        return 0;
+    }
+
+    // pack <file>: writes the exported states read on stdin, one per line, as position records.
+    if (args.size() == 2 && args[0] == "pack")
+    {
+        PositionWriter writer;
+        bool written = writer.open(args[1]);
+        string state;
+        while (written && getline(cin, state))
+        {
+            if (!state.empty() && state.back() == '\r')
+            {
+                state.pop_back();
+            }
+            Board board;
+            if (!state.empty() && (!board.parse(state.data(), state.size()) || !writer.write(board)))
+            {
+                cerr << "Cannot pack " << state << endl;
+            }
+        }
+        cout << writer.getCount() << " positions" << endl;
+        return written && writer.close() ? 0 : 1;
+    }
+
+    // unpack <file> [index]: prints the exported state of one record, or of all of them.
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "unpack")
+    {
+        PositionFile positions;
+        if (!positions.open(args[1]))
+        {
+            cerr << "Cannot read " << args[1] << endl;
+            return 1;
+        }
+        size_t first = args.size() == 3 ? stoull(args[2]) : 0;
+        size_t last = args.size() == 3 ? first + 1 : positions.size();
+        for (size_t i = first; i < last && i < positions.size(); i++)
+        {
+            Board board;
+            cout << (positions.getBoard(i, &board) ? board.exportState() : string("invalid")) << "\n";
+        }
+        return 0;
+    }
 
     // Board b;
     //b.testGrid();
     //b.testManyTurns();
 
-    Die *d;
+    // The engine persists between turns: the transposition table is never cleared and the Monte Carlo tree
+    // is re-rooted on the opponent's reply when it can be found from the position we left.
+    TimeControl timeControl(FIRST_TURN_BUDGET_MS, pondering ? PONDER_TURN_BUDGET_MS : TURN_BUDGET_MS);
+    TranspositionTable table(TABLE_SIZE_LOG2);
+    Arena arena(ARENA_SIZE + threads * Search::getArenaBytes());
+    unique_ptr<Arena> treeArena;
+    Mcts *mcts = nullptr;
+    if (engine == "mcts")
+    {
+        treeArena.reset(new Arena(MCTS_ARENA_SIZE));
+        mcts = treeArena->create<Mcts>(treeArena.get(), 1);
+        if (mcts == nullptr || !mcts->isReady())
+        {
+            arenaExhausted("the Monte Carlo tree");
+        }
+    }
+    Board previous;
+    bool hasPrevious = false;
+    Ponder ponder;
+    STATS(int turn = 0);
+    TurnIO io(STDIN_FILENO, STDOUT_FILENO);
     while (1)
     {
         Board b;
         int diceCount;
-        cin >> diceCount;
-        cin.ignore();
-        for (int i = 0; i < diceCount; i++)
-        {
-            int owner;
-            string cell;
-            int top;
-            int front;
-            int bottom;
-            int back;
-            int left;
-            int right;
-            cin >> owner >> cell >> top >> front >> bottom >> back >> left >> right;
-            cin.ignore();
-            d = new Die(b.toNumber(cell), owner, top, front, bottom, back, left, right);
-            b.addDice(d);
-        }
-
-        // For now, disappointing solution : ignore the tree completely...
-        StrategyTree *tree = new StrategyTree(nullptr);
-        if (diceCount > 2)
-        {
-            b.buildTree(0, tree, 1);
+        bool received = io.readCount(&diceCount);
+        chrono::steady_clock::time_point deadline = timeControl.startTurn();
+        STATS(chrono::steady_clock::time_point turnStart = chrono::steady_clock::now(); string source = "search";
+              SearchStats turnStats; long turnNodes = 0; int turnDepth = 0);
+        ponder.stop();
+        if (!received || !io.readDice(&b, diceCount))
+        {
+            // The referee closed the game.
+            return 0;
+        }
+
+        arena.reset();
+        Move best;
+        // The line we would ponder: the opponent's reply from the principal variation.
+        vector<Move> line;
+        int known;
+        if (tablebase.probe(b, 0, 0, &known))
+        {
+            best = tablebase.bestMove(b, 0, arena.allocateArray<Move>(MAX_MOVES));
+            STATS(source = "tablebase");
+        }
+        else if (book.lookup(b, 0, &best))
+        {
+            // Played straight from the book.
+            STATS(source = "book");
+        }
+        else if (mcts != nullptr)
+        {
+            // Reuse the subtree under the opponent's reply when it can be identified.
+            Move reply;
+            if (!hasPrevious || !previous.findMove(1, b, arena.allocateArray<Move>(MAX_MOVES), &reply) || !mcts->reroot(b, reply))
+            {
+                mcts->setRoot(b);
+            }
+            mcts->setDeadline(deadline);
+            best = mcts->run(0);
+            STATS(source = "mcts"; turnNodes = mcts->getPlayouts(); turnDepth = mcts->getSize());
         }
         else
         {
-            b.buildTree(0, tree, 2);
+            ParallelSearch search(b, &table, &arena, threads);
+            search.setDeadline(deadline);
+            search.setTablebase(&tablebase);
+            best = search.iterate(0, MAX_PLY - 1);
+            line = search.getMain()->getPrincipalVariation();
+            STATS(turnStats = search.getStats(); turnNodes = search.getNodes(); turnDepth = search.getMain()->getDepth());
+        }
+        io.writeMove(best);
+
+#ifdef DICE_STATS
+        // One line per turn, the referee ignores stderr. For the Monte Carlo engine nodes are playouts
+        // and depth is the size of the tree.
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        cerr << fixed << setprecision(1) << "turn " << ++turn << " " << source << " nodes " << turnNodes << " depth " << turnDepth
+             << " moves/die " << (double)turnStats.movesGenerated / max(turnStats.diceGenerated, 1L)
+             << " cutoffs " << 100.0 * turnStats.cutoffs / max(turnStats.expanded, 1L) << "%"
+             << " tt " << 100.0 * turnStats.hits / max(turnStats.probes, 1L) << "%"
+             << " movegen " << turnStats.generationNanos / 1e6 << "ms eval " << turnStats.evaluationNanos / 1e6 << "ms"
+             << " total " << chrono::duration<double, milli>(chrono::steady_clock::now() - turnStart).count() << "ms"
+             << " arena " << arena.getPeak() / 1e6 << "MB rss " << usage.ru_maxrss / 1e3 << "MB" << endl;
+#endif
+
+        previous = b;
+        hasPrevious = best.length > 0;
+        if (!hasPrevious)
+        {
+            continue;
+        }
+        previous.makeMove(best);
+        if (mcts != nullptr)
+        {
+            // The tree follows our move now, pondering grows it under every reply of the opponent.
+            mcts->reroot(previous, best);
+            if (pondering)
+            {
+                mcts->setDeadline(chrono::steady_clock::time_point::max());
+                mcts->setStopSignal(ponder.getStopSignal());
+                ponder.start([mcts]()
+                             { mcts->run(1); });
+            }
+        }
+        else if (pondering && line.size() >= 2)
+        {
+            Board predicted = previous;
+            predicted.makeMove(line[1]);
+            // Nothing of this turn's search is needed any more, the ponder search takes its place in the arena.
+            arena.reset();
+            ponder.start([predicted, &table, &arena, &ponder, &tablebase, threads]()
+                         {
+                             ParallelSearch search(predicted, &table, &arena, threads);
+                             search.setStopSignal(ponder.getStopSignal());
+                             search.setTablebase(&tablebase);
+                             search.iterate(0, MAX_PLY - 1); });
         }
-        tree = tree->getBest();
-        cout << tree->getMoves().back() << endl;
     }
 }
\ No newline at end of file